@@ -4,11 +4,14 @@
 
 #include "dependency.h"
 #include "dependency/ibuildrule.h"
+#include "environment/builddatabase.h"
+#include "environment/buildlog.h"
+#include "environment/filehash.h"
 #include "environment/globals.h"
-#include "environment/popenstream.h"
 #include "environment/prescan.h"
 #include "main/mdebug.h"
 #include "target/ibuildtarget.h"
+#include <optional>
 
 //! Represent a single source file to be built
 class BuildFile : public IBuildRule {
@@ -29,7 +32,8 @@ public:
                           : std::make_unique<Dependency>(
                                 target, type != CppToPcm, Object, this))
         , _filetype(stripFileEnding(filename).second)
-        , _type(type) {
+        , _type(type)
+        , _location(filename.location) {
         auto withoutEnding =
             stripFileEnding(target->getBuildDirectory() + filename);
         if (withoutEnding.first.empty()) {
@@ -69,21 +73,44 @@ public:
         }
     }
 
-    void prescan(IFiles &files, const BuildRuleList &buildFiles) override {
-        if (files.getTimeChanged(_dep->depFile()) >
-            _dep->inputChangedTime(files)) {
+    void scan(const IFiles &files) override {
+        if ((_type != CppToPcm && _type != CppToO) ||
+            !isPrescanNeeded(files)) {
             return;
         }
 
-        if (_type == CppToPcm || _type == CppToO) {
-            auto command = _dep->target()->getCompiler(_filetype) + " " +
-                           _dep->input() + " -E " + getFlags() + " 2>/dev/null";
+        dout << "prescan " << _dep->input() << std::endl;
+
+        _scanResult = SourceScanner(getFlags()).scan(files, _dep->input());
+    }
 
-            POpenStream stream(command);
+    std::string moduleScanCommand(const IFiles &files) override {
+        if ((_type != CppToPcm && _type != CppToO) ||
+            !_dep->target()->hasModules() || !isPrescanNeeded(files)) {
+            return {};
+        }
+        return createCommand();
+    }
 
-            dout << "prescan command: " << command << std::endl;
+    void moduleScanResult(const PrescanResult &result) override {
+        if (!_scanResult) {
+            return;
+        }
+        _scanResult->imports = result.imports;
+        _scanResult->exportModules = result.exportModules;
+    }
 
-            auto deps = ::prescan(stream);
+    void prescan(IFiles &files, const BuildRuleList &buildFiles) override {
+        if (!isPrescanNeeded(files)) {
+            return;
+        }
+
+        if (_type == CppToPcm || _type == CppToO) {
+            if (!_scanResult) {
+                scan(files);
+            }
+            auto deps = std::move(*_scanResult);
+            _scanResult.reset();
 
             dout << "this should be printed to .d-file\n";
             for (auto &include : deps.includes) {
@@ -92,9 +119,7 @@ public:
 
             dout << "\n imports:\n";
 
-            std::ostringstream depFileStream;
-
-            depFileStream << _dep->output() << ":";
+            std::vector<PathId> dependencyFiles;
 
             auto buildDirectory = _dep->target()->getBuildDirectory();
 
@@ -105,50 +130,38 @@ public:
             for (auto &imp : deps.imports) {
                 dout << imp << " ";
 
-                auto importFilename = imp + ".pcm"; // Fix mapping
+                auto importFilename = "/" + imp + ".pcm"; // Fix mapping
 
                 for (auto &bf : buildFiles) {
-                    if (getFilename(bf->dependency().output()) ==
-                        importFilename) {
+                    if (isFilename(bf->dependency().output(),
+                                   importFilename)) {
                         _dep->addDependency(&bf->dependency());
-                        depFileStream
-                            << " "
-                            << bf->dependency().output(); // << imp << ".pcm";
+                        dependencyFiles.push_back(
+                            bf->dependency().outputId());
                         break;
                     }
                 }
             }
 
-            depFileStream << " " << _dep->input();
+            dependencyFiles.push_back(_dep->inputs().front());
 
             for (auto &include : deps.includes) {
-                depFileStream << " " << include;
+                dependencyFiles.emplace_back(include);
             }
 
-            depFileStream << "\n";
-            depFileStream << "\t" << createCommand();
-
-            if (files.getTimeChanged(_dep->depFile()) <
-                _dep->inputChangedTime(files)) {
-                files.replaceFile(_dep->depFile(), depFileStream.str());
-                //                _dep->shouldAddCommandToDepFile(true);
-            }
+            files.buildDatabase().set(_dep->depFile(),
+                                      {dependencyFiles, createCommand()});
 
             dout << std::endl;
         }
         else if (_type == PcmToO) {
-            auto inputChangedTime = _dep->inputChangedTime(files);
             // Note that the object files might not be created yet
-            if (inputChangedTime == 0 ||
-                files.getTimeChanged(_dep->depFile()) < inputChangedTime) {
-                files.replaceFile(_dep->depFile(),
-                                  _dep->output() + ": " + _dep->input() +
-                                      "\n\t" + createCommand());
-                //                _dep->shouldAddCommandToDepFile(true);
-            }
+            auto input = _dep->inputs().front();
+            files.buildDatabase().set(_dep->depFile(),
+                                      {{input}, createCommand()});
 
             for (auto &bf : buildFiles) {
-                if (bf->dependency().output() == _dep->input()) {
+                if (bf->dependency().outputId() == input) {
                     dout << "adding own pcm dependency "
                          << bf->dependency().output() << " to "
                          << _dep->output() << "\n";
@@ -163,10 +176,12 @@ public:
     Token createCommand() {
         Token depCommand;
 
-        //! If not using prescan
-        if (!_dep->target()->hasModules() && _type == CppToO) {
+        // The scanned dependencies can miss headers, for example includes
+        // with macros, so the list from the compiler replaces it when the
+        // file is built. Also for modules
+        if (_type == CppToO || _type == CppToPcm) {
             depCommand = " -MMD -MF " + _dep->depFile() + " ";
-            depCommand.location = _dep->input().location;
+            depCommand.location = _location;
             _shouldAddCommandToDepFile = true;
         }
 
@@ -184,25 +199,29 @@ public:
         //            }
         //        }
 
-        command.location = _dep->input().location;
+        command.location = _location;
 
         return preprocessCommand(command);
     }
 
     void prepare(const IFiles &files, BuildRuleList &rules) override {
+        bool dirty = false;
         auto outputChangedTime = files.getTimeChanged(_dep->output());
         //        auto outputChangedTime = _dep->target()->hasModules()
         //                                     ?
         //                                     files.getTimeChanged(_dep.output())
         //                                     : _dep->changedTime(files);
         if (outputChangedTime < _dep->inputChangedTime(files)) {
-            _dep->dirty(true);
+            dirty = true;
             dout << "file is dirty (outdated)" << std::endl;
         }
 
-        std::vector<std::string> dependencyFiles;
-        std::string oldCommand;
-        tie(dependencyFiles, oldCommand) = files.parseDepFile(_dep->depFile());
+        auto oldEntry = files.buildDatabase().get(
+            _dep->depFile(), [&files](const std::string &path) {
+                return files.parseDepFile(path);
+            });
+        auto &dependencyFiles = oldEntry->dependencies;
+        auto &oldCommand = oldEntry->command;
 
         if (dependencyFiles.empty()) {
             dout << _dep->output()
@@ -211,26 +230,23 @@ public:
             _dep->dirty(true);
         }
         else {
-            for (auto &d : dependencyFiles) {
-                auto ending = stripFileEnding(d, true).second;
+            for (auto d : dependencyFiles) {
+                auto ending = stripFileEnding(d.str(), true).second;
                 if (ending == "pcm") {
                     for (auto &r : rules) {
-                        auto filename = r->dependency().output();
-
-                        if (r->dependency().output() == d) {
+                        if (r->dependency().outputId() == d) {
                             if (r.get() != this) {
                                 _dep->addDependency(&r->dependency());
                             }
                         }
                     }
                 }
-                auto dependencyTimeChanged = files.getTimeChanged(d);
-                if (dependencyTimeChanged == 0 ||
-                    dependencyTimeChanged > outputChangedTime) {
+                auto dependencyTimeChanged = files.getTimeChanged(d.str());
+                if (!dirty && (dependencyTimeChanged == 0 ||
+                               dependencyTimeChanged > outputChangedTime)) {
                     dout << _dep->output() << " is dirty because older than "
                          << d << std::endl;
-                    _dep->dirty(true);
-                    break;
+                    dirty = true;
                 }
             }
         }
@@ -239,7 +255,25 @@ public:
 
         _dep->command(command);
 
-        if (!_dep->dirty() && command != oldCommand) {
+        if (dirty) {
+            if (globals.contentHash && outputChangedTime &&
+                _dep->dependencies().empty() &&
+                files.buildLog().signature(_dep->output()) ==
+                    signature(files, command, dependencyFiles)) {
+                dout << _dep->output()
+                     << " is fresh (same content as last build)" << std::endl;
+                // Make the output newer than the touched files, so that the
+                // content does not need to be checked the next time
+                for (auto out : _dep->outputs()) {
+                    files.touch(out.str());
+                }
+            }
+            else {
+                _dep->dirty(true);
+            }
+        }
+
+        if (!dirty && command != oldCommand) {
             dout << "command is changed for " << _dep->output() << std::endl;
             dout << " old: " << oldCommand << "\n";
             dout << " new: " << command << "\n";
@@ -261,7 +295,22 @@ public:
         if (!_dep->command().empty()) {
             ret = _dep->work(files, pool);
             if (_shouldAddCommandToDepFile) {
-                files.appendToFile(_dep->depFile(), "\t" + _dep->command());
+                // The dependencies is written by the compiler
+                auto entry = BuildDatabase::toEntry(
+                    files.parseDepFile(_dep->depFile()));
+                entry.command = _dep->command();
+                addModuleDependencies(files, entry.dependencies);
+                files.buildDatabase().set(_dep->depFile(), std::move(entry));
+            }
+            if (globals.contentHash) {
+                auto entry = files.buildDatabase().get(_dep->depFile());
+                files.buildLog().signature(
+                    _dep->output(),
+                    signature(files, _dep->command(), entry->dependencies));
+            }
+            else if (files.buildLog().signature(_dep->output())) {
+                // The signature does not match the new output anymore
+                files.buildLog().signature(_dep->output(), 0);
             }
         }
 
@@ -277,12 +326,52 @@ public:
         return _moduleName;
     }
 
+    std::string poolName() const override {
+        auto pool = _dep->target()->properties().get("pool").concat();
+        return pool.empty() ? "compile" : pool;
+    }
+
 private:
     std::unique_ptr<IDependency> _dep;
     Token _filetype; // The ending of the filename
     Type _type = CppToO;
+    Token::Location _location; // Of the source file, for error messages
     std::string _moduleName; // If a c++20 module
     bool _shouldAddCommandToDepFile = false;
+    std::optional<PrescanResult> _scanResult; // Saved from scan() to prescan()
+
+    //! Keep the modules found by the prescan, since the compiler does not
+    //! always write them to the .d-file
+    void addModuleDependencies(const IFiles &files,
+                               std::vector<PathId> &dependencies) const {
+        auto scanned = files.buildDatabase().get(_dep->depFile());
+        for (auto d : scanned->dependencies) {
+            if (stripFileEnding(d.str(), true).second == "pcm" &&
+                std::find(dependencies.begin(), dependencies.end(), d) ==
+                    dependencies.end()) {
+                dependencies.push_back(d);
+            }
+        }
+    }
+
+    //! If the filename part of path is the same as filename, that starts with
+    //! a slash. Compared without copying the path
+    static bool isFilename(const std::string &path,
+                           const std::string &filename) {
+        if (path.size() + 1 == filename.size()) {
+            return filename.compare(1, std::string::npos, path) == 0;
+        }
+        return path.size() > filename.size() &&
+               path.compare(path.size() - filename.size(),
+                            filename.size(),
+                            filename) == 0;
+    }
+
+    //! The saved dependencies is from the last time the file was built
+    bool isPrescanNeeded(const IFiles &files) const {
+        return files.getTimeChanged(_dep->output()) <=
+               _dep->inputChangedTime(files);
+    }
 
     Token fixObjectEnding(Token filename) {
         return removeDoubleDots(_dep->target()->getBuildDirectory() + filename +
@@ -302,4 +391,30 @@ private:
     Token getFlags() {
         return _dep->target()->getBuildFlags(_filetype);
     }
+
+    //! Hash of the command and the content of all files that the output is
+    //! built from. Returns 0 if some file is missing
+    static uint64_t signature(const IFiles &files,
+                              const std::string &command,
+                              const std::vector<PathId> &dependencyFiles) {
+        // The .d-file can be written both by prescan and the compiler, with
+        // the files in different order
+        auto sortedFiles = dependencyFiles;
+        std::sort(sortedFiles.begin(),
+                  sortedFiles.end(),
+                  [](PathId a, PathId b) { return a.str() < b.str(); });
+        sortedFiles.erase(std::unique(sortedFiles.begin(), sortedFiles.end()),
+                          sortedFiles.end());
+
+        auto hash = hashString(command);
+        for (auto &path : sortedFiles) {
+            auto &d = path.str();
+            auto fileHash = files.fileHash(d);
+            if (!fileHash) {
+                return 0;
+            }
+            hash = combineHash(hashString(d, hash), fileHash);
+        }
+        return hash ? hash : 1;
+    }
 };
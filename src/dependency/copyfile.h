@@ -60,12 +60,12 @@ public:
 
             _dep->dirty(false);
 
-            _dep->sendSubscribersNotice(pool);
+            _dep->sendSubscribersNotice(pool, true);
         }
         catch (std::runtime_error &e) {
-            std::cerr << ("could not copy file for target " +
-                          _dep->target()->name() + "\n" + e.what())
-                      << std::endl;
+            pool.print("could not copy file for target " +
+                           _dep->target()->name() + "\n" + e.what() + "\n",
+                       true);
         }
 
         return ss.str();
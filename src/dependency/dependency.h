@@ -8,6 +8,7 @@
 #include "idependency.h"
 #include "main/matmake-common.h"
 #include "target/ibuildtarget.h"
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <set>
@@ -20,13 +21,18 @@ class Dependency : public virtual IDependency {
     IBuildTarget *_target;
     std::set<IDependency *> _subscribers;
     std::mutex _accessMutex;
-    bool _dirty = false;
+    std::atomic<size_t> _pendingDependencies{0}; // Dependencies not built yet
+    std::atomic_bool _isDependencyChanged{false}; // Got new content when built
+    // Files is prepared in parallel, and can be set dirty by dependencies
+    // from other threads
+    std::atomic_bool _dirty{false};
+    std::atomic_bool _isOutdated{false}; // Dirty for other reasons than deps
     //    bool _shouldAddCommandToDepFile = false;
     bool _includeInBinary = true;
     BuildType _buildType = NotSpecified;
 
-    std::vector<Token> _outputs;
-    std::vector<Token> _inputs;
+    std::vector<PathId> _outputs;
+    std::vector<PathId> _inputs;
     Token _command;
     Token _depFile;
     Token _linkString;
@@ -46,22 +52,22 @@ public:
     virtual ~Dependency() override = default;
 
     // Get the latest time of times changed for input files
-    time_t inputChangedTime(const IFiles &files) const override {
-        time_t time = 0;
+    FileTimeT inputChangedTime(const IFiles &files) const override {
+        FileTimeT time = 0;
 
-        for (auto &input : inputs()) {
-            time = std::max(time, files.getTimeChanged(input));
+        for (auto input : _inputs) {
+            time = std::max(time, files.getTimeChanged(input.str()));
         }
 
         return time;
     }
 
     //! Returns the changed time of the oldest of all output files
-    virtual time_t changedTime(const IFiles &files) const override {
-        time_t outputChangedTime = std::numeric_limits<time_t>::max();
+    virtual FileTimeT changedTime(const IFiles &files) const override {
+        FileTimeT outputChangedTime = std::numeric_limits<FileTimeT>::max();
 
-        for (auto &out : _outputs) {
-            auto changedTime = files.getTimeChanged(out);
+        for (auto out : _outputs) {
+            auto changedTime = files.getTimeChanged(out.str());
 
             outputChangedTime = std::min(outputChangedTime, changedTime);
         }
@@ -74,26 +80,43 @@ public:
             dout << "adding " << file->output() << " to " << output() << "\n";
             _dependencies.insert(file);
             file->addSubscriber(this);
+            // Files is prepared in parallel, so the dependency can have been
+            // set dirty before this was added as a subscriber
+            if (file->dirty()) {
+                dirtyByDependency();
+            }
         }
     }
 
-    Token output() const final {
-        if (_outputs.empty()) {
-            return "";
-        }
-        else {
-            return _outputs.front();
-        }
+    const std::string &output() const final {
+        return outputId().str();
+    }
+
+    PathId outputId() const final {
+        return _outputs.empty() ? PathId{} : _outputs.front();
     }
 
     void clean(const IFiles &files) override {
-        for (auto &out : outputs()) {
-            if (std::find(_inputs.begin(), _inputs.end(), out) !=
-                _inputs.end()) {
+        for (auto out : _outputs) {
+            if (isInput(out)) {
                 continue; // Do not remove source files
             }
             vout << "removing file " << out << "\n";
-            files.remove(out.c_str());
+            files.remove(out.str());
+        }
+        if (!_depFile.empty() && files.getTimeChanged(_depFile)) {
+            vout << "removing file " << _depFile << "\n";
+            files.remove(_depFile.c_str());
+        }
+    }
+
+    //! Remove output files from a failed or stopped command, so that half
+    //! written files is not mistaken for finished files in the next build
+    void removeOutputs(const IFiles &files) {
+        for (auto out : _outputs) {
+            if (!isInput(out)) {
+                files.remove(out.str());
+            }
         }
     }
 
@@ -110,10 +133,10 @@ public:
     }
 
     //! Send a notice to all subscribers
-    void sendSubscribersNotice(IThreadPool &pool) override {
+    void sendSubscribersNotice(IThreadPool &pool, bool isChanged) override {
         std::lock_guard<std::mutex> guard(_accessMutex);
         for (auto s : _subscribers) {
-            s->notice(this, pool);
+            s->notice(this, pool, isChanged);
         }
         _subscribers.clear();
     }
@@ -121,17 +144,16 @@ public:
     //! A message from a object being subscribed to
     //! This is used by targets to know when all dependencies
     //! is built
-    void notice(IDependency *d, IThreadPool &pool) override {
-        _dependencies.erase(d);
+    void notice(IDependency *d, IThreadPool &pool, bool isChanged) override {
+        if (isChanged) {
+            _isDependencyChanged = true;
+        }
+        auto remaining = --_pendingDependencies;
         if (globals.debugOutput) {
-            dout << "removing dependency " << d->output() << " from "
-                 << output() << "\n";
-            dout << "   " << _dependencies.size() << " remains ";
-            for (auto d : _dependencies) {
-                dout << d->output() << " " << std::endl;
-            }
+            dout << "dependency " << d->output() << " to " << output()
+                 << " is built, " << remaining << " remains\n";
         }
-        if (_dependencies.empty()) {
+        if (remaining == 0) {
             if (_parentRule) {
                 pool.addTask(this);
                 dout << "Adding " << output() << " to task list " << std::endl;
@@ -165,20 +187,45 @@ public:
         return _dirty;
     }
     void dirty(bool value) final {
-        if (value && !_dirty) {
-            _dirty = true;
-            for (auto &subscriber : _subscribers) {
-                subscriber->dirty(true);
+        _isOutdated = value;
+        if (!value) {
+            _dirty = false;
+        }
+        else if (!_dirty.exchange(true)) {
+            setSubscribersDirty();
+        }
+    }
+
+    void dirtyByDependency() final {
+        if (!_dirty.exchange(true)) {
+            setSubscribersDirty();
+        }
+    }
+
+    bool skipIfUnchanged(const IFiles &files, IThreadPool &pool) override {
+        if (_isOutdated || _isDependencyChanged) {
+            return false;
+        }
+
+        dout << output() << " is not built, dependencies is unchanged\n";
+
+        // Make the outputs newer than the rebuilt dependencies, so that they
+        // are not built the next time either
+        for (auto out : _outputs) {
+            if (files.getTimeChanged(out.str())) {
+                files.touch(out.str());
             }
         }
-        _dirty = value;
+        dirty(false);
+        sendSubscribersNotice(pool, false);
+        return true;
     }
 
     const std::set<class IDependency *> dependencies() const override {
         return _dependencies;
     }
 
-    const std::set<IDependency *> &subscribers() const {
+    const std::set<IDependency *> &subscribers() const override {
         return _subscribers;
     }
 
@@ -191,48 +238,38 @@ public:
     }
 
     //! Set the primary output file for the dependency
-    void output(Token output) override {
-        _outputs.insert(_outputs.begin(), output);
+    void output(const std::string &output) override {
+        _outputs.insert(_outputs.begin(), PathId{output});
     }
 
-    // Set which file to search for dependencies in
-    // this file is also a implicit output file
+    // Set the name that dependencies and the command is saved with in the
+    // build database. Compilers may also write a .d-file with this name
     void depFile(Token file) override {
         _depFile = file;
-        _outputs.push_back(file);
     }
 
     Token depFile() const override {
         return _depFile;
     }
 
-    const std::vector<Token> &outputs() const override {
+    const std::vector<PathId> &outputs() const override {
         return _outputs;
     }
 
-    void inputs(std::vector<Token> in) {
-        _inputs = move(in);
-    }
-
-    void input(Token in) override {
-        _inputs = {move(in)};
+    void input(const std::string &in) override {
+        _inputs = {PathId{in}};
     }
 
-    void addInput(Token in) {
-        _inputs.push_back(in);
+    void addInput(const std::string &in) {
+        _inputs.emplace_back(in);
     }
 
-    std::vector<Token> inputs() const override {
+    const std::vector<PathId> &inputs() const override {
         return _inputs;
     }
 
-    Token input() const override {
-        if (_inputs.empty()) {
-            return "";
-        }
-        else {
-            return _inputs.front();
-        }
+    const std::string &input() const override {
+        return _inputs.empty() ? PathId{}.str() : _inputs.front().str();
     }
 
     void linkString(Token token) override {
@@ -264,11 +301,18 @@ public:
 
         if (!command().empty()) {
             outputStream << command() << "\n";
-            std::pair<int, std::string> res = files.popenWithResult(command());
+            auto res = files.popenWithResult(command());
+            for (auto out : _outputs) {
+                files.invalidate(out.str());
+            }
+            if (res.peakMemory) {
+                files.buildLog().peakMemory(output(), res.peakMemory);
+            }
             if (res.first) {
+                removeOutputs(files);
                 throw MatmakeError(command(),
                                    "could not build object:\n" + command() +
-                                       "\n" + res.second);
+                                       "\n" + res.allOutput());
             }
             else {
                 //                bool overrideDepFileTime =
@@ -287,25 +331,33 @@ public:
                 if (!res.second.empty()) {
                     outputStream << command() + "\n" + res.second + "\n";
                 }
+                if (globals.verbose && !res.errorOutput.empty()) {
+                    // Warnings is printed as one block to stderr
+                    pool.print(command() + "\n" + res.errorOutput + "\n",
+                               true);
+                }
             }
+            auto isChanged = isOutputChanged(files);
             dirty(false);
-            sendSubscribersNotice(pool);
+            sendSubscribersNotice(pool, isChanged);
         }
         return outputStream.str();
     }
 
     void prune() override {
         dout << "pruning " << output() << std::endl;
-        std::vector<IDependency *> toRemove;
+        size_t pending = 0;
         for (auto *dep : _dependencies) {
-            if (!dep->dirty()) {
-                toRemove.push_back(dep);
+            if (dep->dirty()) {
+                ++pending;
             }
         }
-        for (auto d : toRemove) {
-            dout << "removing dependency " << d->output() << std::endl;
-            _dependencies.erase(d);
-        }
+        _pendingDependencies = pending;
+        _isDependencyChanged = false;
+    }
+
+    size_t pendingDependencies() const override {
+        return _pendingDependencies;
     }
 
     BuildType buildType() const override {
@@ -323,4 +375,32 @@ public:
     void parentRule(IBuildRule *rule) override {
         _parentRule = rule;
     }
+
+private:
+    //! With content hashes, a object file is compared with the hash saved
+    //! the last time it was built, so that for example a changed comment
+    //! does not cause relinking. Only the new file is read
+    bool isOutputChanged(const IFiles &files) const {
+        if (!globals.contentHash || _buildType != Object) {
+            return true;
+        }
+        auto &log = files.buildLog();
+        auto hash = files.fileHash(output());
+        auto isChanged = !hash || hash != log.outputHash(output());
+        log.outputHash(output(), hash);
+        return isChanged;
+    }
+
+    bool isInput(PathId path) const {
+        return std::find(_inputs.begin(), _inputs.end(), path) !=
+               _inputs.end();
+    }
+
+    void setSubscribersDirty() {
+        // Subscribers can be added by other threads while files is prepared
+        std::lock_guard<std::mutex> guard(_accessMutex);
+        for (auto &subscriber : _subscribers) {
+            subscriber->dirtyByDependency();
+        }
+    }
 };
@@ -15,6 +15,20 @@ public:
     //! "prepare"-step
     virtual void prescan(IFiles &, const BuildRuleList &) = 0;
 
+    //! Slow work needed by prescan(), like running the preprocessor
+    //! Called for all files in parallel before prescan() is called
+    virtual void scan(const IFiles &) {}
+
+    //! The command that builds the file, used to let the compiler find the
+    //! c++20 modules that the file depends on
+    //! Return empty string if the file does not need to be scanned
+    virtual std::string moduleScanCommand(const IFiles &) {
+        return {};
+    }
+
+    //! Modules found by the compiler, replaces the modules found by scan()
+    virtual void moduleScanResult(const struct PrescanResult &) {}
+
     //! Check if the file is dirty and setup build command
     virtual void prepare(const IFiles &files, BuildRuleList &) = 0;
 
@@ -30,4 +44,10 @@ public:
     virtual std::string moduleName() const {
         return {};
     }
+
+    //! The job pool that limits how many of this kind of job that can run
+    //! at the same time. Return empty string for no limit
+    virtual std::string poolName() const {
+        return {};
+    }
 };
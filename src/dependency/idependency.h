@@ -1,6 +1,8 @@
 #pragma once
 
 #include "buildtype.h"
+#include "environment/ifiles.h"
+#include "main/pathid.h"
 #include "main/token.h"
 #include <memory>
 #include <set>
@@ -26,11 +28,21 @@ public:
     // -------------------------- Other functions -----------------------------
 
     //! Tell a dependency that the built of this file is finished
-    //! Set pruned to true if
-    virtual void notice(IDependency *d, class IThreadPool &pool) = 0;
+    //! @param isChanged false if the output got the same content as before
+    virtual void notice(IDependency *d,
+                        class IThreadPool &pool,
+                        bool isChanged) = 0;
 
     //! A subscriber is a dependency that want a notice when the file is built
-    virtual void sendSubscribersNotice(class IThreadPool &pool) = 0;
+    virtual void sendSubscribersNotice(class IThreadPool &pool,
+                                       bool isChanged) = 0;
+
+    //! If the file only is dirty because dependencies is rebuilt, and all
+    //! of them got the same content as before, the command does not need to
+    //! run. Then the outputs is touched, subscribers is notified and true is
+    //! returned
+    virtual bool skipIfUnchanged(const IFiles &files,
+                                 class IThreadPool &pool) = 0;
 
     virtual IBuildRule *parentRule() = 0;
     virtual void parentRule(IBuildRule *) = 0;
@@ -39,13 +51,20 @@ public:
 
     virtual void addSubscriber(IDependency *s) = 0;
 
+    //! Dependencies that waits for this file to be built
+    virtual const std::set<IDependency *> &subscribers() const = 0;
+
     //! Add a file that this file will wait for
     virtual void addDependency(IDependency *file) = 0;
     virtual const std::set<class IDependency *> dependencies() const = 0;
 
-    //! Remove fresh dependencies from dependency tree
+    //! Count the dirty dependencies that this file has to wait for
     virtual void prune() = 0;
 
+    //! Number of dependencies that is not built yet, the file is ready to be
+    //! built when this reaches zero
+    virtual size_t pendingDependencies() const = 0;
+
     virtual const IBuildTarget *target() const = 0;
 
     // ------------------------------------------------------------------------
@@ -54,17 +73,26 @@ public:
     virtual void dirty(bool) = 0;
     virtual bool dirty() const = 0;
 
+    //! Mark the file as dirty because a dependency is going to be built
+    //! Unlike dirty(true) the file can be skipped if the dependencies turns
+    //! out to be unchanged when they are built
+    virtual void dirtyByDependency() = 0;
+
     //! Get the time when the file was latest changed
     //! 0 means that the file is not built at all
-    virtual time_t changedTime(const IFiles &files) const = 0;
-    virtual time_t inputChangedTime(const IFiles &files) const = 0;
+    virtual FileTimeT changedTime(const IFiles &files) const = 0;
+    virtual FileTimeT inputChangedTime(const IFiles &files) const = 0;
+
+    //! The path to where the target will be built. Paths is stored as
+    //! PathIds, so the string is never copied
+    virtual const std::string &output() const = 0;
+    virtual void output(const std::string &value) = 0;
 
-    //! The path to where the target will be built
-    virtual Token output() const = 0;
-    virtual void output(Token value) = 0;
+    //! The same path as output(), but fast to compare
+    virtual PathId outputId() const = 0;
 
-    //! The main target and implicit targets (often dependency files)
-    virtual const std::vector<Token> &outputs() const = 0;
+    //! The main target and implicit targets
+    virtual const std::vector<PathId> &outputs() const = 0;
 
     //! If the file should be used in the link step
     //! This should be false for pcm files or copied resource files
@@ -75,9 +103,9 @@ public:
     virtual void linkString(Token token) = 0;
     virtual Token linkString() const = 0;
 
-    virtual void input(Token in) = 0;
-    virtual std::vector<Token> inputs() const = 0;
-    virtual Token input() const = 0;
+    virtual void input(const std::string &in) = 0;
+    virtual const std::vector<PathId> &inputs() const = 0;
+    virtual const std::string &input() const = 0;
     virtual void depFile(Token file) = 0;
     virtual Token depFile() const = 0;
     virtual Token command() const = 0;
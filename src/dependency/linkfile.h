@@ -10,10 +10,15 @@
 #include "compilertype.h"
 #include "dependency/dependency.h"
 #include "dependency/ibuildrule.h"
+#include "environment/builddatabase.h"
 
 class LinkFile : public IBuildRule {
 
 public:
+    //! Commands longer than this uses a response file for the object files,
+    //! to not hit the limits of the command line length
+    inline static size_t responseFileLimit = 32000;
+
     LinkFile(const LinkFile &) = delete;
     LinkFile(LinkFile &&) = delete;
     LinkFile(Token filename,
@@ -50,18 +55,18 @@ public:
         }
         _isBuildCalled = true;
 
-        auto exe = _dep->output();
+        auto &exe = _dep->output();
         if (exe.empty() || _dep->target()->name() == "root") {
             return;
         }
 
         _dep->dirty(false);
 
-        time_t lastDependency = 0;
+        FileTimeT lastDependency = 0;
         for (auto &d : _dep->dependencies()) {
             auto t = d->changedTime(files);
             if (d->dirty()) {
-                _dep->dirty(true);
+                _dep->dirtyByDependency();
             }
             lastDependency = std::max(t, lastDependency);
             if (t == 0) {
@@ -78,24 +83,37 @@ public:
 
         prepareCommand();
 
-        std::vector<std::string> oldDependencies;
-        std::string oldCommand;
-        tie(oldDependencies, oldCommand) = files.parseDepFile(_dep->depFile());
-        if (_dep->command() != oldCommand) {
+        auto oldEntry = files.buildDatabase().get(
+            _dep->depFile(), [&files](const std::string &path) {
+                return files.parseDepFile(path);
+            });
+        if (_fullCommand != oldEntry->command) {
             dout << _dep->output() << " command differs \n";
-            dout << _dep->command() << "\n";
-            dout << oldCommand << "\n\n";
+            dout << _fullCommand << "\n";
+            dout << oldEntry->command << "\n\n";
             _dep->dirty(true);
         }
     }
 
     std::string work(const IFiles &files, IThreadPool &pool) override {
         if (!_dep->command().empty()) {
-            {
-                files.replaceFile(_dep->depFile(),
-                                  _dependencyString + "\t" + _dep->command());
+            std::string output;
+            if (_responseFileContent.empty()) {
+                output = _dep->work(files, pool);
             }
-            return _dep->work(files, pool);
+            else {
+                files.replaceFile(responseFile(), _responseFileContent);
+                output = _dep->work(files, pool);
+                // Only kept on failure, to be able to debug the command
+                files.remove(responseFile());
+            }
+
+            // The full command is saved so that changed object files is
+            // detected even when a response file is used. A failed command
+            // throws, so it is not saved and is run again the next time
+            files.buildDatabase().set(_dep->depFile(),
+                                      {_dependencies, _fullCommand});
+            return output;
         }
 
         return {};
@@ -105,6 +123,11 @@ public:
         return *_dep;
     }
 
+    std::string poolName() const override {
+        auto pool = _dep->target()->properties().get("pool").concat();
+        return pool.empty() ? "link" : pool;
+    }
+
 private:
     void prepareCommand() {
         Token fileList;
@@ -115,11 +138,24 @@ private:
             }
         }
 
-        _dependencyString = prepareDependencyString();
+        _dependencies = prepareDependencies();
 
+        _fullCommand = createCommand(fileList);
+        if (_fullCommand.size() > responseFileLimit) {
+            _responseFileContent = fileList;
+            _dep->command(createCommand("@" + responseFile()));
+        }
+        else {
+            _responseFileContent.clear();
+            _dep->command(_fullCommand);
+        }
+    }
+
+    //! Create the link command for a list of files, or a response file
+    Token createCommand(Token fileList) const {
         auto cpp = _dep->target()->getCompiler("cpp");
 
-        auto exe = _dep->output();
+        auto &exe = _dep->output();
         auto buildType = _dep->target()->buildType();
         Token cmd;
         if (buildType == Shared) {
@@ -153,17 +189,20 @@ private:
             cmd.pop_back();
         }
 
-        _dep->command(cmd);
+        return cmd;
+    }
+
+    //! Both gcc, clang and ar reads arguments from "@file"
+    Token responseFile() const {
+        return _dep->output() + ".rsp";
     }
 
-    std::string prepareDependencyString() const {
-        std::ostringstream ss;
-        ss << _dep->output() << ":";
+    std::vector<PathId> prepareDependencies() const {
+        std::vector<PathId> ret;
         for (auto &d : _dep->dependencies()) {
-            ss << " " << d->output();
+            ret.push_back(d->outputId());
         }
-        ss << "\n";
-        return ss.str();
+        return ret;
     }
 
     //! This is to check if should include linker -rpath or similar
@@ -179,5 +218,7 @@ private:
     std::unique_ptr<IDependency> _dep;
     bool _isBuildCalled = false;
     ICompiler *_compilerType;
-    std::string _dependencyString;
+    std::vector<PathId> _dependencies;
+    Token _fullCommand; // The command as it would be without response file
+    std::string _responseFileContent;
 };
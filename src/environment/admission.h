@@ -0,0 +1,196 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "environment/globals.h"
+#include "environment/jobserver.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+//! Decides if the thread pool is allowed to start a new job, based on the
+//! load of the computer, the amount of free memory and the memory that the
+//! running jobs is expected to use
+//!
+//! The number of parallel jobs is never more than globals.numberOfThreads,
+//! but may be less if the computer is busy with other things or if a
+//! jobserver does not give out tokens for more jobs
+class AdmissionControl {
+public:
+    virtual ~AdmissionControl() = default;
+
+    //! Check if a new job can be started, and if so count it as running
+    //! A job is always started if there is no other jobs running, otherwise
+    //! the build could never finish
+    //! @param memory the memory in MB that the job is expected to use
+    //! @param pool the job pool of the job, empty for no pool
+    //! @return true if the job is allowed to start
+    bool tryStart(long memory = 0, const std::string &pool = {}) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto hasResources = hasSystemResources();
+        _isLimitedBySystem = false;
+        if (isPoolFull(pool)) {
+            return false;
+        }
+        if (_running > 0) {
+            if (isOverMemoryBudget(memory)) {
+                return false;
+            }
+            // The first job uses the implicit token of the process
+            if (!hasResources || !tryAcquireToken()) {
+                _isLimitedBySystem = true;
+                return false;
+            }
+            ++_tokens;
+        }
+        ++_running;
+        _reservedMemory += memory;
+        if (!pool.empty()) {
+            ++_pools[pool].running;
+        }
+        return true;
+    }
+
+    //! Tell that a job that was started with tryStart() is finished
+    void finish(long memory = 0, const std::string &pool = {}) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        --_running;
+        _reservedMemory -= memory;
+        if (!pool.empty()) {
+            --_pools[pool].running;
+        }
+        if (_tokens > 0 && _tokens >= _running) {
+            releaseToken();
+            --_tokens;
+        }
+    }
+
+    //! True if the last job was refused because of the load, the free
+    //! memory or the jobserver. Nothing tells when they change, so they must
+    //! be checked again after a while. Other limits changes when a job is
+    //! finished
+    bool isLimitedBySystem() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _isLimitedBySystem;
+    }
+
+    size_t running() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _running;
+    }
+
+    //! Set the maximal number of jobs that can run at the same time in a
+    //! job pool. 0 means no limit
+    void poolSize(const std::string &pool, size_t size) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _pools[pool].size = size;
+    }
+
+    //! The one minute load average of the system, 0 if unknown
+    virtual double loadAverage() {
+#ifndef _WIN32
+        double load = 0;
+        if (getloadavg(&load, 1) == 1) {
+            return load;
+        }
+#endif
+        return 0;
+    }
+
+    //! Memory available for new processes in megabytes, -1 if unknown
+    virtual long availableMemory() {
+        std::ifstream file("/proc/meminfo");
+        for (std::string line; getline(file, line);) {
+            std::istringstream ss(line);
+            std::string name;
+            long value = 0;
+            if (ss >> name >> value && name == "MemAvailable:") {
+                return value / 1024; // The value is in kB
+            }
+        }
+        return -1;
+    }
+
+    //! Get a token from the jobserver for one more job than the first
+    virtual bool tryAcquireToken() {
+        return jobServer.tryAcquire();
+    }
+
+    virtual void releaseToken() {
+        jobServer.release();
+    }
+
+private:
+    struct Pool {
+        size_t size = 0;
+        size_t running = 0;
+    };
+
+    //! Must be called with _mutex locked
+    bool isPoolFull(const std::string &pool) const {
+        auto f = _pools.find(pool);
+        return f != _pools.end() && f->second.size &&
+               f->second.running >= f->second.size;
+    }
+
+    //! Must be called with _mutex locked
+    bool isOverMemoryBudget(long memory) const {
+        return globals.memoryBudget &&
+               static_cast<size_t>(_reservedMemory + memory) >
+                   globals.memoryBudget;
+    }
+
+    //! Must be called with _mutex locked
+    bool hasSystemResources() {
+        using namespace std::chrono;
+
+        if (!globals.maxLoad && !globals.minFreeMemory) {
+            return true;
+        }
+
+        // Reading the system files on every check is unnecessary since the
+        // values does not change that fast
+        auto now = steady_clock::now();
+        if (now - _lastMeasurement > milliseconds(200) || !_hasMeasurement) {
+            _lastMeasurement = now;
+            _hasMeasurement = true;
+            _load = globals.maxLoad ? loadAverage() : 0;
+            _runningAtMeasurement = _running;
+            _memory = globals.minFreeMemory ? availableMemory() : -1;
+        }
+
+        if (globals.maxLoad) {
+            // The load already includes the jobs started by this build, only
+            // the load from other processes limits the number of jobs
+            auto otherLoad = std::max(
+                0., _load - static_cast<double>(_runningAtMeasurement));
+            if (otherLoad + _running + 1 > globals.maxLoad) {
+                return false;
+            }
+        }
+
+        if (globals.minFreeMemory && _memory >= 0 &&
+            static_cast<size_t>(_memory) < globals.minFreeMemory) {
+            return false;
+        }
+
+        return true;
+    }
+
+    mutable std::mutex _mutex;
+    size_t _running = 0;
+    size_t _tokens = 0; // Jobserver tokens held by running jobs
+    long _reservedMemory = 0;
+    bool _isLimitedBySystem = false; // Reason for the last refused job
+    bool _hasMeasurement = false;
+    std::chrono::steady_clock::time_point _lastMeasurement;
+    double _load = 0;
+    size_t _runningAtMeasurement = 0;
+    long _memory = -1;
+    std::map<std::string, Pool> _pools;
+};
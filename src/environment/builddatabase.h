@@ -0,0 +1,401 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "environment/buildlog.h"
+#include "environment/mappedfile.h"
+#include "main/pathid.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+//! The dependencies and the command used to build files, saved in a single
+//! binary file instead of one .d-file for each file
+//!
+//! The file is memory mapped and read once at startup. Changed entries is
+//! appended to the end of the file when saved, and the file is rewritten
+//! when it contains to many old entries. The file is not meant to be moved
+//! between machines
+//!
+//! Dependencies is stored as PathIds, since the same headers is used by
+//! most files. Entries is shared with the callers instead of copied
+//!
+//! The build log, with durations, memory use and content hashes, is saved
+//! in the same file
+class BuildDatabase {
+public:
+    struct Entry {
+        std::vector<PathId> dependencies;
+        std::string command;
+    };
+
+    //! Never null. Replaced entries is kept alive for the callers that still
+    //! uses them
+    using EntryPtr = std::shared_ptr<const Entry>;
+
+    //! The dependencies and the command, as returned from
+    //! IFiles::parseDepFile()
+    using DepFileContent = std::pair<std::vector<PathId>, std::string>;
+
+    //! Name of the file that the database is saved to
+    static constexpr const char *defaultFilename = ".matmake_db";
+
+    //! Load the database from file. A missing, damaged or outdated file is
+    //! treated as a empty database
+    void load(std::string path = defaultFilename) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _path = std::move(path);
+        _entries.clear();
+        _changed.clear();
+        _numberOfRecords = 0;
+        _validSize = 0;
+        std::lock_guard<std::mutex> logGuard(_log._mutex);
+        _log._entries.clear();
+        _log._fileHashes.clear();
+        _log._changedEntries.clear();
+        _log._changedFileHashes.clear();
+
+        MappedFile file(_path);
+        parse(file.view().data(), file.view().size());
+    }
+
+    //! Save changed entries to the file that the database was loaded from
+    void save() {
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::lock_guard<std::mutex> logGuard(_log._mutex);
+        if (!isChanged() || _path.empty()) {
+            return;
+        }
+
+        // Append if the file is still the same as when it was loaded, and
+        // at least half of the records in it is still used
+        if (_validSize && _validSize == fileSize(_path) &&
+            _numberOfRecords <= numberOfEntries() * 2) {
+            std::ofstream file(_path, std::ios::binary | std::ios::app);
+            for (auto &key : _changed) {
+                writeRecord(file, key, *_entries.at(key));
+            }
+            for (auto &output : _log._changedEntries) {
+                writeRecord(file, output, _log._entries.at(output));
+            }
+            for (auto &path : _log._changedFileHashes) {
+                writeRecord(file, path, _log._fileHashes.at(path));
+            }
+            file.flush();
+            if (file) {
+                _numberOfRecords += _changed.size() +
+                                    _log._changedEntries.size() +
+                                    _log._changedFileHashes.size();
+                _validSize = fileSize(_path);
+                clearChanged();
+                return;
+            }
+        }
+
+        // Hashes of removed files would otherwise be kept forever
+        for (auto it = _log._fileHashes.begin();
+             it != _log._fileHashes.end();) {
+            if (exists(it->first)) {
+                ++it;
+            }
+            else {
+                it = _log._fileHashes.erase(it);
+            }
+        }
+
+        // Replace the file so that a interrupted save does not damage it
+        auto tmpPath = _path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::binary);
+            file.write(header, headerSize);
+            for (auto &entry : _entries) {
+                writeRecord(file, entry.first, *entry.second);
+            }
+            for (auto &entry : _log._entries) {
+                writeRecord(file, entry.first, entry.second);
+            }
+            for (auto &entry : _log._fileHashes) {
+                writeRecord(file, entry.first, entry.second);
+            }
+        }
+        if (std::rename(tmpPath.c_str(), _path.c_str()) == 0) {
+            _numberOfRecords = numberOfEntries();
+            _validSize = fileSize(_path);
+            clearChanged();
+        }
+    }
+
+    //! Durations, memory use and content hashes that is saved together with
+    //! the dependencies
+    BuildLog &log() {
+        return _log;
+    }
+
+    //! Get a entry, or a empty entry if there is none
+    EntryPtr get(const std::string &key) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _entries.find(key);
+        if (f != _entries.end()) {
+            return f->second;
+        }
+        return emptyEntry();
+    }
+
+    //! Get a entry, or call read and save the result if there is no entry
+    //! Used to read old .d-files that is not in the database yet
+    //! @param read returns DepFileContent
+    template <typename ReadT>
+    EntryPtr get(const std::string &key, ReadT read) {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            auto f = _entries.find(key);
+            if (f != _entries.end()) {
+                return f->second;
+            }
+        }
+
+        auto entry = toEntry(read(key));
+        if (entry.dependencies.empty() && entry.command.empty()) {
+            return emptyEntry();
+        }
+        return set(key, std::move(entry));
+    }
+
+    //! @return the entry that is stored
+    EntryPtr set(const std::string &key, Entry entry) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto &old = _entries[key];
+        if (!old || old->dependencies != entry.dependencies ||
+            old->command != entry.command) {
+            old = std::make_shared<const Entry>(std::move(entry));
+            _changed.insert(key);
+        }
+        return old;
+    }
+
+    //! The paths from a .d-file is already interned
+    static Entry toEntry(DepFileContent content) {
+        return {std::move(content.first), std::move(content.second)};
+    }
+
+private:
+    static const EntryPtr &emptyEntry() {
+        static const EntryPtr entry = std::make_shared<const Entry>();
+        return entry;
+    }
+
+    static constexpr const char *header = "matmake db v2\n";
+    static constexpr size_t headerSize = 14;
+
+    // The first byte of each record
+    static constexpr char dependencyRecord = 'd';
+    static constexpr char logRecord = 'o';
+    static constexpr char fileHashRecord = 'h';
+
+    //! Must be called with both mutexes locked
+    bool isChanged() const {
+        return !_changed.empty() || !_log._changedEntries.empty() ||
+               !_log._changedFileHashes.empty();
+    }
+
+    //! Must be called with both mutexes locked
+    void clearChanged() {
+        _changed.clear();
+        _log._changedEntries.clear();
+        _log._changedFileHashes.clear();
+    }
+
+    //! Must be called with both mutexes locked
+    size_t numberOfEntries() const {
+        return _entries.size() + _log._entries.size() +
+               _log._fileHashes.size();
+    }
+
+    static bool exists(const std::string &path) {
+        struct stat fileStat;
+        return stat(path.c_str(), &fileStat) == 0;
+    }
+
+    static size_t fileSize(const std::string &path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return 0;
+        }
+        return static_cast<size_t>(file.tellg());
+    }
+
+    //! Must be called with _mutex locked
+    void parse(const char *data, size_t size) {
+        if (size < headerSize || std::memcmp(data, header, headerSize)) {
+            return;
+        }
+
+        auto position = headerSize;
+        auto readNumber = [&](uint32_t &value) {
+            if (size - position < sizeof(value)) {
+                return false;
+            }
+            std::memcpy(&value, data + position, sizeof(value));
+            position += sizeof(value);
+            return true;
+        };
+        auto readView = [&](std::string_view &value) {
+            uint32_t length = 0;
+            if (!readNumber(length) || size - position < length) {
+                return false;
+            }
+            value = {data + position, length};
+            position += length;
+            return true;
+        };
+        auto readString = [&](std::string &value) {
+            std::string_view view;
+            if (!readView(view)) {
+                return false;
+            }
+            value.assign(view);
+            return true;
+        };
+        auto readNumbers = [&](auto &...values) {
+            uint64_t value = 0;
+            auto read = [&](auto &target) {
+                if (size - position < sizeof(value)) {
+                    return false;
+                }
+                std::memcpy(&value, data + position, sizeof(value));
+                position += sizeof(value);
+                target = static_cast<std::decay_t<decltype(target)>>(value);
+                return true;
+            };
+            return (read(values) && ...);
+        };
+
+        // A record that is cut off, for example if matmake was killed while
+        // saving, is ignored together with everything after it
+        while (position < size) {
+            auto type = data[position++];
+            std::string key;
+            if (!readString(key)) {
+                return;
+            }
+
+            if (type == dependencyRecord) {
+                Entry entry;
+                uint32_t numberOfDependencies = 0;
+                if (!readString(entry.command) ||
+                    !readNumber(numberOfDependencies) ||
+                    numberOfDependencies >
+                        (size - position) / sizeof(uint32_t)) {
+                    return;
+                }
+                entry.dependencies.resize(numberOfDependencies);
+                for (auto &dependency : entry.dependencies) {
+                    // Only paths that is not seen before is copied
+                    std::string_view path;
+                    if (!readView(path)) {
+                        return;
+                    }
+                    dependency = PathId{path};
+                }
+                _entries[std::move(key)] =
+                    std::make_shared<const Entry>(std::move(entry));
+            }
+            else if (type == logRecord) {
+                BuildLogEntry entry;
+                if (!readNumbers(entry.duration,
+                                 entry.peakMemory,
+                                 entry.signature,
+                                 entry.outputHash)) {
+                    return;
+                }
+                _log._entries[std::move(key)] = entry;
+            }
+            else if (type == fileHashRecord) {
+                FileHashEntry entry;
+                if (!readNumbers(entry.changedTime,
+                                 entry.size,
+                                 entry.inode,
+                                 entry.hash)) {
+                    return;
+                }
+                _log._fileHashes[std::move(key)] = entry;
+            }
+            else {
+                return;
+            }
+            ++_numberOfRecords;
+            _validSize = position;
+        }
+        _validSize = position; // Also when there is no records
+    }
+
+    static void writeNumber(std::ostream &file, uint32_t value) {
+        file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static void writeString(std::ostream &file, const std::string &value) {
+        writeNumber(file, static_cast<uint32_t>(value.size()));
+        file.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    static void writeNumbers(std::ostream &file,
+                             std::initializer_list<uint64_t> values) {
+        for (auto value : values) {
+            file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+    }
+
+    static void writeRecord(std::ostream &file,
+                            const std::string &key,
+                            const Entry &entry) {
+        file.put(dependencyRecord);
+        writeString(file, key);
+        writeString(file, entry.command);
+        writeNumber(file, static_cast<uint32_t>(entry.dependencies.size()));
+        for (auto &dependency : entry.dependencies) {
+            writeString(file, dependency.str());
+        }
+    }
+
+    static void writeRecord(std::ostream &file,
+                            const std::string &output,
+                            const BuildLogEntry &entry) {
+        file.put(logRecord);
+        writeString(file, output);
+        writeNumbers(file,
+                     {static_cast<uint64_t>(entry.duration),
+                      static_cast<uint64_t>(entry.peakMemory),
+                      entry.signature,
+                      entry.outputHash});
+    }
+
+    static void writeRecord(std::ostream &file,
+                            const std::string &path,
+                            const FileHashEntry &entry) {
+        file.put(fileHashRecord);
+        writeString(file, path);
+        writeNumbers(file,
+                     {static_cast<uint64_t>(entry.changedTime),
+                      static_cast<uint64_t>(entry.size),
+                      entry.inode,
+                      entry.hash});
+    }
+
+    mutable std::mutex _mutex;
+    std::string _path;
+    std::unordered_map<std::string, EntryPtr> _entries;
+    std::set<std::string> _changed; // Keys that is not saved yet
+    size_t _numberOfRecords = 0;    // Including old versions of entries
+    size_t _validSize = 0;          // Bytes of the file that could be read
+    BuildLog _log;
+};
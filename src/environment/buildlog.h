@@ -0,0 +1,154 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+
+//! Information about a single output file that is saved between builds
+struct BuildLogEntry {
+    long duration = 0;       // Time to build the file in milliseconds
+    long peakMemory = 0;     // Maximal memory used to build the file in MB
+    uint64_t signature = 0;  // Hash of the inputs and the command, 0 = unknown
+    uint64_t outputHash = 0; // Content hash of the output when it was built
+};
+
+//! The content hash of a file, and what the file looked like when it was
+//! hashed, to know if it needs to be hashed again
+struct FileHashEntry {
+    long long changedTime = 0;
+    long long size = 0;
+    uint64_t inode = 0;
+    uint64_t hash = 0;
+};
+
+//! Information saved between builds, for example how long time it took to
+//! build each file, how much memory was used the last time it was built and
+//! content hashes of files
+//!
+//! The log is saved in the build database, which keeps track of what is
+//! changed so that only changed entries is written
+class BuildLog {
+public:
+    //! Duration of the last build of the output in milliseconds
+    //! returns 0 if the file has never been built
+    long duration(const std::string &output) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _entries.find(output);
+        if (f != _entries.end()) {
+            return f->second.duration;
+        }
+        return 0;
+    }
+
+    void duration(const std::string &output, long value) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _entries[output].duration = value;
+        _changedEntries.insert(output);
+    }
+
+    //! Maximal memory used in MB the last time the output was built
+    //! returns 0 if unknown
+    long peakMemory(const std::string &output) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _entries.find(output);
+        if (f != _entries.end()) {
+            return f->second.peakMemory;
+        }
+        return 0;
+    }
+
+    void peakMemory(const std::string &output, long value) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _entries[output].peakMemory = value;
+        _changedEntries.insert(output);
+    }
+
+    //! Hash of the inputs and the command the last time the output was built
+    //! returns 0 if unknown
+    uint64_t signature(const std::string &output) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _entries.find(output);
+        if (f != _entries.end()) {
+            return f->second.signature;
+        }
+        return 0;
+    }
+
+    void signature(const std::string &output, uint64_t value) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _entries[output].signature = value;
+        _changedEntries.insert(output);
+    }
+
+    //! Content hash of the output the last time it was built
+    //! returns 0 if unknown
+    uint64_t outputHash(const std::string &output) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _entries.find(output);
+        if (f != _entries.end()) {
+            return f->second.outputHash;
+        }
+        return 0;
+    }
+
+    void outputHash(const std::string &output, uint64_t value) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _entries[output].outputHash = value;
+        _changedEntries.insert(output);
+    }
+
+    //! The last known content hash of a file
+    std::optional<FileHashEntry> fileHash(const std::string &path) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto f = _fileHashes.find(path);
+        if (f != _fileHashes.end()) {
+            return f->second;
+        }
+        return {};
+    }
+
+    void fileHash(const std::string &path, FileHashEntry entry) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _fileHashes[path] = entry;
+        _changedFileHashes.insert(path);
+    }
+
+    //! Mean duration of all files with known durations, used to guess the
+    //! duration of files that has never been built
+    long averageDuration() const {
+        return average(&BuildLogEntry::duration);
+    }
+
+    //! Mean memory usage of all files with known memory usage
+    long averagePeakMemory() const {
+        return average(&BuildLogEntry::peakMemory);
+    }
+
+private:
+    friend class BuildDatabase;
+
+    template <typename T>
+    long average(T BuildLogEntry::*member) const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        long sum = 0;
+        long count = 0;
+        for (auto &entry : _entries) {
+            if (entry.second.*member) {
+                sum += entry.second.*member;
+                ++count;
+            }
+        }
+        return count ? sum / count : 0;
+    }
+
+    mutable std::mutex _mutex;
+    std::map<std::string, BuildLogEntry> _entries;
+    std::map<std::string, FileHashEntry> _fileHashes;
+    std::set<std::string> _changedEntries; // Not saved yet
+    std::set<std::string> _changedFileHashes;
+};
@@ -0,0 +1,361 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "dependency/idependency.h"
+#include "environment/globals.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+//! Prints the output from jobs and a status line with the running jobs and
+//! the estimated time left of the build
+//!
+//! Everything is printed from a single thread so that output from different
+//! jobs is never mixed up with each other or with the status line. While the
+//! thread is running std::cout and std::cerr is redirected to it, so that
+//! debug and verbose output is also printed a whole line at a time
+//!
+//! When stdout is not a terminal, for example in a log file, a plain line is
+//! printed for each finished job instead of the status line
+class BuildStatus {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    BuildStatus() = default;
+    BuildStatus(const BuildStatus &) = delete;
+    BuildStatus &operator=(const BuildStatus &) = delete;
+
+    ~BuildStatus() {
+        stop();
+    }
+
+    //! Start the thread that prints
+    //! @param totalTasks number of tasks in the build
+    //! @param totalWork expected time for all tasks in milliseconds
+    //! @param parallelism number of jobs that can run at the same time
+    //! @param isTerminal if stdout can show a status line
+    void start(size_t totalTasks,
+               long totalWork,
+               size_t parallelism,
+               bool isTerminal = BuildStatus::isTerminal()) {
+        stop();
+        std::lock_guard<std::mutex> guard(_mutex);
+        _totalTasks = totalTasks;
+        _finishedTasks = 0;
+        _notStartedWork = totalWork;
+        _parallelism = std::max<size_t>(1, parallelism);
+        _running.clear();
+        _shouldStop = false;
+        _showStatusLine = isTerminal && !globals.debugOutput;
+        // Verbose mode already prints a line for each job
+        _showProgressLines =
+            !isTerminal && !globals.debugOutput && !globals.verbose;
+        _outBuffer = std::cout.rdbuf(&_outRedirect);
+        _errBuffer = std::cerr.rdbuf(&_errRedirect);
+        _thread = std::thread([this] { printLoop(); });
+    }
+
+    //! Print everything that is left and remove the status line
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _shouldStop = true;
+        }
+        _condition.notify_one();
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        if (_outBuffer) {
+            std::cout.rdbuf(_outBuffer);
+            std::cerr.rdbuf(_errBuffer);
+            _outBuffer = nullptr;
+            _errBuffer = nullptr;
+            // Text that did not end with a new line
+            std::cout << _outRedirect.takeAll() << std::flush;
+            std::cerr << _errRedirect.takeAll() << std::flush;
+        }
+    }
+
+    //! @param expectedDuration the time the job is guessed to take in ms
+    void jobStarted(const IDependency *job,
+                    std::string name,
+                    long expectedDuration) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _running[job] = {std::move(name), expectedDuration, Clock::now()};
+        _notStartedWork = std::max(0L, _notStartedWork - expectedDuration);
+    }
+
+    void jobFinished(const IDependency *job) {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            ++_finishedTasks;
+            auto found = _running.find(job);
+            if (found == _running.end()) {
+                return;
+            }
+            if (_showProgressLines && _thread.joinable() && !_shouldStop) {
+                _messages.push_back({"[" + std::to_string(_finishedTasks) +
+                                     "/" + std::to_string(_totalTasks) + "] " +
+                                     found->second.name + "\n"});
+            }
+            _running.erase(found);
+        }
+        _condition.notify_one();
+    }
+
+    //! Queue text to be printed by the printing thread, or print it directly
+    //! if the thread is not started
+    void print(std::string text, bool isError = false) {
+        {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (_thread.joinable() && !_shouldStop) {
+                _messages.push_back({std::move(text), isError});
+                text.clear();
+            }
+        }
+        if (text.empty()) {
+            _condition.notify_one();
+        }
+        else {
+            stream(isError) << text << std::flush;
+        }
+    }
+
+    //! The time in milliseconds that is estimated to be left of the build
+    //! @param now the time to calculate from
+    long remainingTime(Clock::time_point now) const {
+        using namespace std::chrono;
+        std::lock_guard<std::mutex> guard(_mutex);
+        long remainingWork = _notStartedWork;
+        for (auto &job : _running) {
+            auto elapsed =
+                duration_cast<milliseconds>(now - job.second.startTime)
+                    .count();
+            remainingWork +=
+                std::max(0L, job.second.expectedDuration - elapsed);
+        }
+        return remainingWork / static_cast<long>(_parallelism);
+    }
+
+    //! Percent of the tasks that is finished
+    int progress() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_totalTasks) {
+            return static_cast<int>(_finishedTasks * 100 / _totalTasks);
+        }
+        return 100;
+    }
+
+private:
+    //! Collects text written to std::cout or std::cerr from any thread and
+    //! sends each finished line to be printed
+    class Redirect : public std::streambuf {
+    public:
+        Redirect(BuildStatus &status, bool isError)
+            : _status(status)
+            , _isError(isError) {}
+
+        //! Remove and return the text that is not finished with a new line
+        std::string takeAll() {
+            std::lock_guard<std::mutex> guard(_mutex);
+            std::string text;
+            for (auto &line : _lines) {
+                text += line.second;
+            }
+            _lines.clear();
+            return text;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (c != traits_type::eof()) {
+                auto ch = traits_type::to_char_type(c);
+                xsputn(&ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *data,
+                               std::streamsize size) override {
+            std::string finished;
+            {
+                std::lock_guard<std::mutex> guard(_mutex);
+                auto &line = _lines[std::this_thread::get_id()];
+                line.append(data, static_cast<size_t>(size));
+                auto end = line.rfind('\n');
+                if (end != std::string::npos) {
+                    finished = line.substr(0, end + 1);
+                    line.erase(0, end + 1);
+                }
+            }
+            if (!finished.empty()) {
+                _status.print(std::move(finished), _isError);
+            }
+            return size;
+        }
+
+    private:
+        BuildStatus &_status;
+        bool _isError;
+        std::mutex _mutex;
+        // Each thread has its own unfinished line
+        std::map<std::thread::id, std::string> _lines;
+    };
+
+    struct Job {
+        std::string name;
+        long expectedDuration = 0;
+        Clock::time_point startTime;
+    };
+
+    struct Message {
+        std::string text;
+        bool isError = false;
+    };
+
+    static bool isTerminal() {
+#ifndef _WIN32
+        return isatty(STDOUT_FILENO);
+#else
+        return false;
+#endif
+    }
+
+    static size_t terminalWidth() {
+#ifndef _WIN32
+        winsize size = {};
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col) {
+            return size.ws_col;
+        }
+#endif
+        return 80;
+    }
+
+    static std::string formatTime(long milliseconds) {
+        auto seconds = milliseconds / 1000;
+        std::ostringstream ss;
+        if (seconds >= 60) {
+            ss << seconds / 60 << "m ";
+        }
+        ss << seconds % 60 << "s";
+        return ss.str();
+    }
+
+    //! The stream that was used before the output was redirected
+    std::ostream stream(bool isError) const {
+        auto buffer = isError ? _errBuffer : _outBuffer;
+        return std::ostream(buffer ? buffer
+                                   : (isError ? std::cerr : std::cout).rdbuf());
+    }
+
+    //! Must be called with _mutex unlocked
+    std::string statusLine() const {
+        using namespace std::chrono;
+        auto now = Clock::now();
+        auto remainingTime = this->remainingTime(now);
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        std::vector<std::pair<long, const Job *>> running;
+        for (auto &job : _running) {
+            auto elapsed =
+                duration_cast<milliseconds>(now - job.second.startTime)
+                    .count();
+            running.push_back({static_cast<long>(elapsed), &job.second});
+        }
+
+        // The jobs that has been running the longest is probably the most
+        // interesting
+        std::sort(running.begin(), running.end(), [](auto &a, auto &b) {
+            return a.first > b.first;
+        });
+
+        std::ostringstream ss;
+        ss << "[" << (_totalTasks ? _finishedTasks * 100 / _totalTasks : 100)
+           << "%] " << _finishedTasks << "/" << _totalTasks << " ETA "
+           << formatTime(remainingTime);
+        for (auto &job : running) {
+            ss << "  " << job.second->name << " " << formatTime(job.first);
+        }
+
+        auto line = ss.str();
+        auto width = terminalWidth() - 1;
+        if (line.size() > width) {
+            line.resize(width);
+        }
+        return line;
+    }
+
+    void printLoop() {
+        using namespace std::chrono;
+        std::unique_lock<std::mutex> lock(_mutex);
+        bool isLineShown = false;
+
+        while (true) {
+            _condition.wait_for(lock, milliseconds(200), [this] {
+                return !_messages.empty() || _shouldStop;
+            });
+
+            auto messages = std::move(_messages);
+            _messages.clear();
+            auto shouldStop = _shouldStop;
+            lock.unlock();
+            auto line = (_showStatusLine && !shouldStop) ? statusLine() : "";
+
+            auto out = stream(false);
+            if (isLineShown && (!messages.empty() || shouldStop ||
+                                !line.empty())) {
+                out << "\r\033[K";
+                isLineShown = false;
+            }
+            for (auto &message : messages) {
+                if (message.isError) {
+                    out.flush();
+                    stream(true) << message.text << std::flush;
+                }
+                else {
+                    out << message.text;
+                }
+            }
+            if (!line.empty()) {
+                out << line;
+                isLineShown = true;
+            }
+            out.flush();
+
+            if (shouldStop) {
+                break;
+            }
+            lock.lock();
+        }
+    }
+
+    mutable std::mutex _mutex;
+    std::condition_variable _condition;
+    Redirect _outRedirect{*this, false};
+    Redirect _errRedirect{*this, true};
+    std::streambuf *_outBuffer = nullptr; // std::cout before redirecting
+    std::streambuf *_errBuffer = nullptr;
+    std::thread _thread;
+    std::vector<Message> _messages;
+    std::map<const IDependency *, Job> _running;
+    size_t _totalTasks = 0;
+    size_t _finishedTasks = 0;
+    long _notStartedWork = 0; // Expected time for jobs not started, in ms
+    size_t _parallelism = 1;
+    bool _shouldStop = false;
+    bool _showStatusLine = false;
+    bool _showProgressLines = false; // One line per job when not a terminal
+};
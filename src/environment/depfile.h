@@ -0,0 +1,125 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "main/pathid.h"
+#include <array>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//! Parse the content of a .d-file written by the compiler (-MMD) or by
+//! matmake, without copying the file or splitting it in lines
+//!
+//! Paths is interned as PathIds directly from the data, so only paths that
+//! is new to the program is copied
+//!
+//! Escaped characters is handled the same way as make does: "\ " is a space
+//! in a path, "\#" is a # and "$$" is a $. Other backslashes is part of the
+//! path, to handle windows paths. A line that starts with a tab after the
+//! rule is the command that was used to build the file
+//!
+//! @return the dependencies and the command, the same as
+//! IFiles::parseDepFile()
+inline std::pair<std::vector<PathId>, std::string> parseDepFileContent(
+    std::string_view data) {
+    // Characters that ends a simple path
+    static const auto isSpecial = [] {
+        std::array<bool, 256> table = {};
+        for (auto c : " \t\r\n\\$") {
+            table[static_cast<unsigned char>(c)] = true;
+        }
+        return table;
+    }();
+
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+    std::pair<std::vector<PathId>, std::string> ret;
+    auto &dependencies = ret.first;
+    auto size = data.size();
+    size_t i = 0;
+
+    // The targets is before the first ':', they is not returned
+    bool isTarget = true;
+    std::string path; // Only used for paths with escaped characters
+
+    while (i < size) {
+        auto c = data[i];
+        if (isSpace(c)) {
+            ++i;
+            continue;
+        }
+        if (c == '\n') {
+            ++i;
+            if (!isTarget) {
+                break; // End of the rule
+            }
+            continue;
+        }
+        if (c == '\\' && i + 1 < size &&
+            (data[i + 1] == '\n' ||
+             (data[i + 1] == '\r' && i + 2 < size && data[i + 2] == '\n'))) {
+            i += (data[i + 1] == '\r') ? 3 : 2; // Line continuation
+            continue;
+        }
+
+        auto begin = i;
+        while (i < size && !isSpecial[static_cast<unsigned char>(data[i])]) {
+            ++i;
+        }
+
+        auto token = data.substr(begin, i - begin);
+        if (i < size && (data[i] == '\\' || data[i] == '$')) {
+            // Slow path for paths with escaped characters
+            path.assign(token);
+            while (i < size) {
+                c = data[i];
+                auto next = (i + 1 < size) ? data[i + 1] : '\0';
+                if (isSpace(c) || c == '\n') {
+                    break;
+                }
+                if (c == '\\' && (next == '\n' || next == '\r')) {
+                    break;
+                }
+                if ((c == '\\' && (next == ' ' || next == '#')) ||
+                    (c == '$' && next == '$')) {
+                    path += next;
+                    i += 2;
+                }
+                else {
+                    path += c;
+                    ++i;
+                }
+            }
+            token = path;
+        }
+
+        if (isTarget) {
+            isTarget = token.empty() || token.back() != ':';
+        }
+        else {
+            dependencies.emplace_back(token);
+        }
+    }
+
+    // Phony rules for headers (-MP) is skipped
+    while (i < size) {
+        auto end = static_cast<const char *>(
+            std::memchr(data.data() + i, '\n', size - i));
+        auto lineEnd = end ? static_cast<size_t>(end - data.data()) : size;
+        if (data[i] == '\t') {
+            auto line = data.substr(i, lineEnd - i);
+            auto first = line.find_first_not_of(" \t");
+            auto last = line.find_last_not_of(" \t\r");
+            if (first != std::string_view::npos) {
+                ret.second = line.substr(first, last - first + 1);
+            }
+            break;
+        }
+        i = lineEnd + 1;
+    }
+
+    return ret;
+}
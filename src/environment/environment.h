@@ -5,6 +5,7 @@
 #include "environment/ienvironment.h"
 
 #include "globals.h"
+#include "p1689.h"
 #include "main/matmake.h"
 #include "main/token.h"
 #include "target/buildtarget.h"
@@ -13,7 +14,12 @@
 #include "target/targets.h"
 #include "threadpool.h"
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <set>
 
 class Environment : public IEnvironment {
 public:
@@ -85,6 +91,10 @@ public:
     //! Transfer all information parsed from the matmake-file
     void setTargetProperties(TargetPropertyCollection properties) {
         for (auto &property : properties) {
+            if (property->name() == "pool") {
+                setPoolSizes(*property);
+                continue;
+            }
             bool isRoot = property->name() == "root";
             auto target = std::make_unique<BuildTarget>(move(property));
             if (isRoot) {
@@ -94,6 +104,18 @@ public:
         }
     }
 
+    //! Job pools is specified like "pool.link = 4" in the Matmakefile
+    void setPoolSizes(const TargetProperties &pools) {
+        for (auto &property : pools.properties()) {
+            auto value = property.second.concat();
+            // Properties inherited from root is not numbers
+            if (!value.empty() &&
+                std::all_of(value.begin(), value.end(), ::isdigit)) {
+                _tasks.poolSize(property.first, std::stoul(value));
+            }
+        }
+    }
+
     void print() {
         for (auto &v : _targets) {
             v->print();
@@ -153,12 +175,117 @@ public:
         return files;
     }
 
-    void prescan(const BuildRuleList &files) const {
+    //! The slow part of the prescan is done for all files in parallel on the
+    //! workers of the build, and the results is added to the dependency
+    //! graph when all is finished
+    void prescan(const BuildRuleList &files) {
+        _tasks.forEach(files, [this](auto &file) {
+            file->scan(*_fileHandler);
+        });
+
+        if (!globals.scanDeps.empty()) {
+            scanModules(files);
+        }
+
         for (auto &file : files) {
             file->prescan(*_fileHandler, files);
         }
     }
 
+    //! Let the compiler find the modules that files depend on. All files is
+    //! scanned with a single call to clang-scan-deps, that runs in parallel
+    //! and shares work between the files
+    void scanModules(const BuildRuleList &files) const {
+        const std::string databasePath = ".matmake_scan.json";
+        const std::string resultPath = ".matmake_scan.ddi";
+
+        std::map<std::string, IBuildRule *> scannedFiles;
+        std::string database;
+        auto directory = _fileHandler->currentDirectory();
+        for (auto &file : files) {
+            auto command = file->moduleScanCommand(*_fileHandler);
+            if (command.empty()) {
+                continue;
+            }
+            auto &dep = file->dependency();
+            scannedFiles[dep.output()] = file.get();
+            database += std::string(database.empty() ? "[\n" : ",\n") +
+                        "{\"directory\": " + json::quote(directory) +
+                        ", \"command\": " + json::quote(command) +
+                        ", \"file\": " + json::quote(dep.input()) +
+                        ", \"output\": " + json::quote(dep.output()) + "}";
+        }
+        if (scannedFiles.empty()) {
+            return;
+        }
+        _fileHandler->replaceFile(databasePath, database + "\n]\n");
+
+        auto command = globals.scanDeps +
+                       " -format=p1689 -compilation-database=" + databasePath +
+                       " -j " + std::to_string(globals.numberOfThreads) +
+                       " > " + resultPath;
+        dout << "module scan command: " << command << std::endl;
+        auto result = _fileHandler->popenWithResult(command);
+
+        if (result.first) {
+            std::cerr << "could not scan modules with " << globals.scanDeps
+                      << ", using matmakes own scanner\n"
+                      << result.allOutput() << std::endl;
+        }
+        else {
+            auto file = _fileHandler->openRead(resultPath);
+            auto modules = parseP1689(
+                std::string((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>()));
+            for (auto &module : modules) {
+                auto f = scannedFiles.find(module.first);
+                if (f != scannedFiles.end()) {
+                    f->second->moduleScanResult(module.second);
+                }
+            }
+        }
+
+        _fileHandler->remove(databasePath);
+        _fileHandler->remove(resultPath);
+    }
+
+    //! Check which files that needs to be built. Object files is checked in
+    //! parallel since they mostly wait for the file system. Files that
+    //! depends on them is checked afterwards in dependency order
+    void prepare(BuildRuleList &files) {
+        std::vector<IBuildRule *> objectFiles;
+        std::set<IBuildRule *> otherFiles;
+        for (auto &file : files) {
+            if (file->dependency().buildType() == Object) {
+                objectFiles.push_back(file.get());
+            }
+            else {
+                otherFiles.insert(file.get());
+            }
+        }
+
+        _tasks.forEach(objectFiles, [&](IBuildRule *file) {
+            file->prepare(*_fileHandler, files);
+        });
+
+        std::set<IBuildRule *> preparedFiles;
+        std::function<void(IBuildRule *)> prepareFile = [&](IBuildRule *file) {
+            if (!otherFiles.count(file) || !preparedFiles.insert(file).second) {
+                return;
+            }
+            for (auto dependency : file->dependency().dependencies()) {
+                if (auto rule = dependency->parentRule()) {
+                    prepareFile(rule);
+                }
+            }
+            file->prepare(*_fileHandler, files);
+        };
+
+        for (auto &file : files) {
+            prepareFile(file.get());
+        }
+    }
+
     static void printTree(IDependency &dependency, int depth = 1) {
         for (auto &dep : dependency.dependencies()) {
             std::cout << std::string(depth * 2, ' ');
@@ -216,13 +343,13 @@ public:
         auto files =
             calculateDependencies(parseTargetArguments(targetArguments));
 
+        _fileHandler->buildDatabase().load();
+
         createDirectories(files);
 
         prescan(files);
 
-        for (auto &file : files) {
-            file->prepare(*_fileHandler, files);
-        }
+        prepare(files);
 
         printTree();
 
@@ -232,7 +359,7 @@ public:
                 dout << "file " << file->dependency().output() << " is dirty"
                      << std::endl;
                 _tasks.addTaskCount();
-                if (file->dependency().dependencies().empty()) {
+                if (file->dependency().pendingDependencies() == 0) {
                     _tasks.addTask(&file->dependency());
                 }
             }
@@ -243,6 +370,7 @@ public:
         }
         buildExternal(true, "");
         work(std::move(files));
+        _fileHandler->buildDatabase().save();
         buildExternal(false, "");
     }
 
@@ -276,7 +404,7 @@ public:
             auto res = _fileHandler->popenWithResult("./" + test.name);
             if (res.first) {
                 std::cerr << "\nTest " << test.name << " failed:\n";
-                std::cerr << res.second << std::endl;
+                std::cerr << res.allOutput() << std::endl;
                 ++numFailed;
                 test.failed = true;
             }
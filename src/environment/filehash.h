@@ -0,0 +1,30 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//! Fast non cryptographic hash (64 bit FNV-1a) used to see if the content of
+//! a file is changed
+//! @param hash the hash to continue from, to hash data in several parts
+inline uint64_t hashBytes(const char *data,
+                          size_t size,
+                          uint64_t hash = 14695981039346656037ULL) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(const std::string &str,
+                           uint64_t hash = 14695981039346656037ULL) {
+    return hashBytes(str.data(), str.size(), hash);
+}
+
+//! Mix a hash into another hash, the order matters
+inline uint64_t combineHash(uint64_t hash, uint64_t value) {
+    return hashBytes(reinterpret_cast<const char *>(&value), sizeof(value), hash);
+}
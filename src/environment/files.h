@@ -5,6 +5,7 @@
 #include "main/merror.h"
 #include "main/token.h"
 #include <array>
+#include <chrono>
 #include <fstream>
 #include <stdexcept>
 #include <string>
@@ -14,6 +15,7 @@
 
 #ifdef _WIN32
 #include <direct.h>
+#include <sys/utime.h>
 #define GetCurrentDir _getcwd
 #define popen _popen
 #define pclose _pclose
@@ -30,10 +32,19 @@
 #include <sys/types.h>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
+#include "environment/builddatabase.h"
+#include "environment/buildlog.h"
+#include "environment/depfile.h"
+#include "environment/filehash.h"
 #include "environment/ifiles.h"
+#include "environment/mappedfile.h"
+#include "environment/prescan.h"
+#include "environment/process.h"
+#include "environment/statcache.h"
 
 // Joins two paths and makes sure that the path separator does not
 // end up in the beginning of the new path
@@ -182,46 +193,73 @@ public:
         return ret;
     }
 
-    std::pair<int, std::string> popenWithResult(
-        std::string command) const override {
+    PopenResult popenWithResult(std::string command) const override {
+        return runCommand(command);
+    }
 
-        std::pair<int, std::string> ret;
+    int system(const std::string& command) const override {
+        auto ret = std::system(command.c_str());
+        clearCaches(); // The command could have changed anything
+        return ret;
+    }
 
-        FILE *file = popen((command + " 2>&1").c_str(), "r");
+    FileTimeT getTimeChanged(const std::string &path) const override {
+        return _statCache.get(path, [](const std::string &path) -> FileTimeT {
+            struct stat file_stat;
+            int err = stat(path.c_str(), &file_stat);
+            if (err != 0) {
+                // dout << "notice: file does not exist: " << path << endl;
+                return 0;
+            }
+            return timeChanged(file_stat);
+        });
+    }
 
-        if (!file) {
-            return {-1, "failed to execute command " + command};
+    uint64_t fileHash(const std::string &path) const override {
+        struct stat file_stat;
+        if (stat(path.c_str(), &file_stat) != 0) {
+            return 0;
         }
 
-        constexpr int size = 50;
-        char buffer[size];
+        FileHashEntry entry;
+        entry.changedTime = timeChanged(file_stat);
+        entry.size = file_stat.st_size;
+        entry.inode = file_stat.st_ino;
 
-        while (fgets(buffer, size, file)) {
-            ret.second += buffer;
+        auto old = buildLog().fileHash(path);
+        if (old && old->changedTime == entry.changedTime &&
+            old->size == entry.size && old->inode == entry.inode) {
+            return old->hash;
         }
 
-        auto result = pclose(file); // On some systems, not creating a variable
-                                    // for the result leads to a error.
-#ifdef _WIN32
-        ret.first = result;
-#else
-        ret.first = WEXITSTATUS(result);
-#endif
-        return ret;
-    }
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return 0;
+        }
+        std::array<char, 1 << 16> buffer;
+        entry.hash = hashBytes(nullptr, 0);
+        while (file.read(buffer.data(), buffer.size()) || file.gcount()) {
+            entry.hash = hashBytes(buffer.data(),
+                                   static_cast<size_t>(file.gcount()),
+                                   entry.hash);
+        }
+        if (!entry.hash) {
+            entry.hash = 1; // 0 is reserved for missing files
+        }
 
-    int system(const std::string& command) const override {
-        return std::system(command.c_str());
+        // A file changed very recently could be changed again without
+        // getting a new time (racy file), so it is hashed again next time
+        auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+        if (entry.changedTime < now - 2000000000LL) {
+            buildLog().fileHash(path, entry);
+        }
+        return entry.hash;
     }
 
-    time_t getTimeChanged(const std::string &path) const override {
-        struct stat file_stat;
-        int err = stat(path.c_str(), &file_stat);
-        if (err != 0) {
-            // dout << "notice: file does not exist: " << path << endl;
-            return 0;
-        }
-        return file_stat.st_mtime;
+    void invalidate(const std::string &path) const override {
+        invalidateCaches(path);
     }
 
     std::ifstream openRead(const std::string &path) const override {
@@ -244,6 +282,8 @@ public:
     }
 
     bool currentDirectory(std::string directory) const override {
+        // The cache uses relative paths
+        clearCaches();
         return chdir(directory.c_str());
     }
 
@@ -339,15 +379,27 @@ public:
     }
 
     int remove(std::string filename) const override {
+        invalidateCaches(filename);
         return ::remove(filename.c_str());
     }
 
+    void touch(const std::string &path) const override {
+#ifdef _WIN32
+        _utime(path.c_str(), nullptr);
+#else
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+#endif
+        invalidateCaches(path);
+    }
+
     void appendToFile(std::string name, std::string value) const override {
         std::ofstream(name, std::ofstream::app) << value;
+        invalidateCaches(name);
     }
 
     void replaceFile(std::string name, std::string value) const override {
         std::ofstream(name) << value;
+        invalidateCaches(name);
     }
 
     void copyFile(std::string source, std::string destination) const override {
@@ -364,6 +416,8 @@ public:
         }
 
         dst << src.rdbuf();
+        dst.close();
+        invalidateCaches(destination);
     }
 
     std::vector<std::string> readLines(std::string source) const override {
@@ -380,42 +434,55 @@ public:
         return lines;
     };
 
-    std::pair<std::vector<std::string>, std::string> parseDepFile(
+    std::pair<std::vector<PathId>, std::string> parseDepFile(
         Token depFile) const override {
-        using namespace std;
-        try {
-            auto lines = readLines(depFile);
-            vector<string> ret;
-            string command;
-
-            bool firstLine = true;
-            for (auto line : lines) {
-                istringstream ss(line);
-
-                if (!line.empty() && line.front() == '\t') {
-                    command = trim(line);
-                    break;
-                }
-                else {
-                    string d;
-                    if (firstLine) {
-                        ss >> d; // The first is the target path --> ignore
-                        firstLine = false;
-                    }
-                    while (ss >> d) {
-                        if (d !=
-                            "\\") { // Skip backslash (is used before newlines)
-                            ret.push_back(d);
-                        }
-                    }
-                }
-            }
-            return {ret, command};
-        }
-        catch (std::runtime_error &e) {
-            dout << "could not find .d file " << depFile << endl;
+        MappedFile file(depFile);
+        if (file.empty()) {
+            dout << "could not find .d file " << depFile << std::endl;
             return {};
         }
+        return parseDepFileContent(file.view());
+    }
+
+    BuildLog &buildLog() const override {
+        return _buildDatabase.log();
+    }
+
+    BuildDatabase &buildDatabase() const override {
+        return _buildDatabase;
+    }
+
+    ScanCache &scanCache() const override {
+        return _scanCache;
+    }
+
+private:
+    //! Nanoseconds, so that files changed within the same second can be
+    //! compared
+    static FileTimeT timeChanged(const struct stat &file_stat) {
+#if defined(_WIN32)
+        return file_stat.st_mtime * 1000000000LL;
+#elif defined(__APPLE__)
+        return file_stat.st_mtimespec.tv_sec * 1000000000LL +
+               file_stat.st_mtimespec.tv_nsec;
+#else
+        return file_stat.st_mtim.tv_sec * 1000000000LL +
+               file_stat.st_mtim.tv_nsec;
+#endif
+    }
+
+    mutable BuildDatabase _buildDatabase;
+    mutable StatCache _statCache;
+    mutable ScanCache _scanCache;
+
+    void invalidateCaches(const std::string &path) const {
+        _statCache.invalidate(path);
+        _scanCache.invalidate(path);
+    }
+
+    void clearCaches() const {
+        _statCache.clear();
+        _scanCache.clear();
     }
 };
 
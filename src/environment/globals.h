@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <string>
 #include <thread>
 
 //! Global variables shared by the whole program
@@ -13,7 +15,14 @@ struct Globals {
     size_t numberOfThreads =
         std::thread::hardware_concurrency(); // Get the maximal number of
                                              // threads
-    bool bailout = false; // when true: exit the program in a controlled way
+    double maxLoad = 0; // Do not start new jobs above this load, 0 = no limit
+    size_t minFreeMemory = 0; // Free memory in MB needed to start new jobs
+    size_t memoryBudget = 0;  // Memory in MB that all jobs may use together
+    size_t maxFailures = 1;   // Stop after this many failed files, 0 = never
+    bool contentHash = false; // Only rebuild when the content of files change
+    std::string scanDeps; // Command that finds module dependencies, if any
+    std::atomic_bool bailout{
+        false}; // when true: exit the program in a controlled way
 };
 
 inline Globals globals;
@@ -1,8 +1,36 @@
 #pragma once
 
+#include "main/pathid.h"
 #include "main/token.h"
-#include <vector>
+#include <cstdint>
 #include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+class BuildDatabase;
+class BuildLog;
+class ScanCache;
+
+//! Time when a file was changed in nanoseconds since epoch
+//! 0 means that the file does not exist
+using FileTimeT = long long;
+
+//! The result of running a external command
+//! first is the exit code and second is the output of the command to stdout
+struct PopenResult : public std::pair<int, std::string> {
+    PopenResult() = default;
+    PopenResult(int code, std::string output, long peakMemory = 0)
+        : pair(code, std::move(output)), peakMemory(peakMemory) {}
+
+    //! Both stdout and stderr
+    std::string allOutput() const {
+        return second + errorOutput;
+    }
+
+    std::string errorOutput; // Output to stderr
+    long peakMemory = 0;     // Maximal memory used in megabytes, 0 if unknown
+};
 
 class IFiles {
 public:
@@ -10,14 +38,22 @@ public:
 
     virtual std::vector<Token> findFiles(Token pattern) const = 0;
 
-    virtual std::pair<int, std::string> popenWithResult(
-        std::string command) const = 0;
+    virtual PopenResult popenWithResult(std::string command) const = 0;
 
     virtual int system(const std::string &command) const = 0;
 
     //! Return timecode when time is changed, lower is older, higher is newer
     //! return 0 if file is not found
-    virtual time_t getTimeChanged(const std::string &path) const = 0;
+    virtual FileTimeT getTimeChanged(const std::string &path) const = 0;
+
+    //! Tell that a file may have been changed by someone else, for example
+    //! by a command, so that the next getTimeChanged() checks the file again
+    virtual void invalidate(const std::string &path) const = 0;
+
+    //! Hash of the content of a file, the hash is remembered in the build
+    //! log and only calculated again if the file is changed
+    //! return 0 if the file is not found
+    virtual uint64_t fileHash(const std::string &path) const = 0;
 
     virtual std::ifstream openRead(const std::string &path) const = 0;
 
@@ -38,6 +74,9 @@ public:
 
     virtual int remove(std::string filename) const = 0;
 
+    //! Set the changed time of a existing file to the current time
+    virtual void touch(const std::string &path) const = 0;
+
     virtual void replaceFile(std::string name, std::string value) const = 0;
     virtual void appendToFile(std::string name, std::string value) const = 0;
 
@@ -47,8 +86,19 @@ public:
 
     virtual std::vector<std::string> readLines(std::string source) const = 0;
 
-    virtual std::pair<std::vector<std::string>, std::string> parseDepFile(
+    virtual std::pair<std::vector<PathId>, std::string> parseDepFile(
         Token depFile) const = 0;
+
+    //! Durations, memory use and content hashes, saved in the build database
+    virtual BuildLog &buildLog() const = 0;
+
+    //! Dependencies and commands saved between builds in the current
+    //! directory
+    virtual BuildDatabase &buildDatabase() const = 0;
+
+    //! Directives and headers found by the dependency scanner in the current
+    //! directory
+    virtual ScanCache &scanCache() const = 0;
 };
 
 std::string removeDoubleDots(std::string string);
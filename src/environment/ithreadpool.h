@@ -1,6 +1,12 @@
 #pragma once
 
+#include <string>
+
 class IThreadPool {
 public:
     virtual void addTask(class IDependency *t) = 0;
+
+    //! Print output from a job without mixing it up with output from other
+    //! jobs
+    virtual void print(std::string text, bool isError = false) = 0;
 };
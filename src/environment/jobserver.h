@@ -0,0 +1,268 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "main/mdebug.h"
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+//! Shares the number of parallel jobs with make and other build systems
+//! using the GNU make jobserver protocol
+//!
+//! If matmake is started from make with a jobserver, it acts as a client
+//! and only runs more than one job when it gets tokens from make. Otherwise
+//! matmake creates the jobserver itself and exports it through MAKEFLAGS so
+//! that make, matmake and compilers (eg. -flto=jobserver) started by matmake
+//! share the same number of jobs.
+//!
+//! Every process has one implicit token, so the first job of a process
+//! never needs to wait for a token.
+class JobServer {
+public:
+    //! Describes how to connect to a jobserver
+    struct Auth {
+        int readFd = -1;
+        int writeFd = -1;
+        std::string fifo; // Used instead of file descriptors by make >= 4.4
+
+        bool empty() const {
+            return readFd < 0 && fifo.empty();
+        }
+    };
+
+    JobServer() = default;
+    JobServer(const JobServer &) = delete;
+    JobServer &operator=(const JobServer &) = delete;
+
+    ~JobServer() {
+        close();
+    }
+
+    //! Find the jobserver in MAKEFLAGS, or create a new jobserver for
+    //! numberOfJobs jobs if there is none
+    //! Only the first call has any effect, later calls (for example from
+    //! external projects) uses the same jobserver
+    void init(size_t numberOfJobs) {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_isInitialized) {
+            return;
+        }
+        _isInitialized = true;
+
+        auto makeFlags = getenv("MAKEFLAGS");
+        auto auth = parseMakeFlags(makeFlags ? makeFlags : "");
+        if (!auth.empty()) {
+            _isActive = connect(auth);
+            if (_isActive) {
+                dout << "using jobserver from make" << std::endl;
+            }
+        }
+        else if (numberOfJobs > 1) {
+            _isActive = createServer(numberOfJobs, makeFlags ? makeFlags : "");
+        }
+#else
+        (void)numberOfJobs;
+#endif
+    }
+
+    //! If the jobserver is used at all
+    bool isActive() const {
+        return _isActive;
+    }
+
+    //! Try to get a token without waiting
+    //! @return true if a token was aquired (or if no jobserver is used)
+    bool tryAcquire() {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_isActive) {
+            return true;
+        }
+
+        if (!_isNonBlocking) {
+            // Another process may still take the token before it is read,
+            // but the read only blocks until any job is finished
+            pollfd pfd = {_readFd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) <= 0) {
+                return false;
+            }
+        }
+
+        char token = 0;
+        if (read(_readFd, &token, 1) == 1) {
+            _tokens.push_back(token);
+            return true;
+        }
+        return false;
+#else
+        return true;
+#endif
+    }
+
+    //! Give back a token aquired with tryAcquire()
+    void release() {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (!_isActive || _tokens.empty()) {
+            return;
+        }
+
+        // Make uses the value of the token to report errors, so the same
+        // value is given back
+        auto token = _tokens.back();
+        while (write(_writeFd, &token, 1) < 0 && errno == EINTR) {
+        }
+        _tokens.pop_back();
+#endif
+    }
+
+    //! Find jobserver information in a MAKEFLAGS string
+    static Auth parseMakeFlags(const std::string &flags) {
+        Auth auth;
+        for (auto option : {"--jobserver-auth=", "--jobserver-fds="}) {
+            auto f = flags.rfind(option);
+            if (f == std::string::npos) {
+                continue;
+            }
+            auto begin = f + std::string(option).size();
+            auto value = flags.substr(begin, flags.find(' ', begin) - begin);
+
+            if (value.rfind("fifo:", 0) == 0) {
+                auth.fifo = value.substr(5);
+            }
+            else {
+                auto comma = value.find(',');
+                if (comma == std::string::npos) {
+                    continue;
+                }
+                auth.readFd = atoi(value.substr(0, comma).c_str());
+                auth.writeFd = atoi(value.substr(comma + 1).c_str());
+            }
+            return auth;
+        }
+        return auth;
+    }
+
+private:
+#ifndef _WIN32
+    //! Connect as a client to a jobserver created by someone else
+    bool connect(const Auth &auth) {
+        if (!auth.fifo.empty()) {
+            _readFd = open(auth.fifo.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            _writeFd = open(auth.fifo.c_str(), O_WRONLY | O_CLOEXEC);
+            _isNonBlocking = true;
+            _ownsFds = true;
+            if (_readFd < 0 || _writeFd < 0) {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        // Make does not pass the file descriptors when the command is not
+        // marked as recursive, then they are not valid
+        if (fcntl(auth.readFd, F_GETFD) < 0 ||
+            fcntl(auth.writeFd, F_GETFD) < 0) {
+            dout << "jobserver from make is not available" << std::endl;
+            return false;
+        }
+
+        _writeFd = auth.writeFd;
+
+        // Opening the pipe again gives a separate file description that can
+        // be non blocking without affecting make
+        auto path = "/proc/self/fd/" + std::to_string(auth.readFd);
+        _readFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (_readFd >= 0) {
+            _isNonBlocking = true;
+            _ownsReadFd = true;
+        }
+        else {
+            _readFd = auth.readFd;
+        }
+        return true;
+    }
+
+    //! Create a new jobserver and export it to child processes
+    bool createServer(size_t numberOfJobs, std::string makeFlags) {
+        int fds[2];
+        // The file descriptors is inherited by child processes on purpose
+        if (pipe(fds)) {
+            return false;
+        }
+
+        _readFd = fds[0];
+        _writeFd = fds[1];
+        _ownsFds = true;
+
+        std::string tokens(numberOfJobs - 1, '+');
+        if (write(_writeFd, tokens.data(), tokens.size()) !=
+            static_cast<ssize_t>(tokens.size())) {
+            close();
+            return false;
+        }
+
+        auto path = "/proc/self/fd/" + std::to_string(_readFd);
+        auto nonBlockingFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (nonBlockingFd >= 0) {
+            _serverReadFd = _readFd;
+            _readFd = nonBlockingFd;
+            _isNonBlocking = true;
+        }
+
+        auto fdString = std::to_string(fds[0]) + "," + std::to_string(fds[1]);
+        makeFlags += " -j" + std::to_string(numberOfJobs) +
+                     " --jobserver-fds=" + fdString +
+                     " --jobserver-auth=" + fdString;
+        setenv("MAKEFLAGS", makeFlags.c_str(), true);
+
+        dout << "created jobserver with " << numberOfJobs << " jobs"
+             << std::endl;
+
+        return true;
+    }
+
+    void close() {
+        if (_ownsFds || _ownsReadFd) {
+            if (_readFd >= 0) {
+                ::close(_readFd);
+            }
+        }
+        if (_ownsFds) {
+            if (_writeFd >= 0) {
+                ::close(_writeFd);
+            }
+            if (_serverReadFd >= 0) {
+                ::close(_serverReadFd);
+            }
+        }
+        _readFd = _writeFd = _serverReadFd = -1;
+        _isActive = false;
+    }
+
+    int _readFd = -1;
+    int _writeFd = -1;
+    int _serverReadFd = -1; // Blocking end kept open for child processes
+    bool _ownsFds = false;
+    bool _ownsReadFd = false;
+    bool _isNonBlocking = false;
+#else
+    void close() {}
+#endif
+
+    std::mutex _mutex;
+    bool _isInitialized = false;
+    bool _isActive = false;
+    std::vector<char> _tokens; // Tokens that is currently taken
+};
+
+inline JobServer jobServer;
@@ -0,0 +1,80 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//! A file that is read only and mapped to memory, to read it without copying
+//! A missing or empty file gives a empty view
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    MappedFile(const std::string &path) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+            auto size = static_cast<size_t>(fileStat.st_size);
+            auto address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                _data = static_cast<const char *>(address);
+                _size = size;
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+        if (content.empty()) {
+            return;
+        }
+        auto buffer = new char[content.size()];
+        std::memcpy(buffer, content.data(), content.size());
+        _data = buffer;
+        _size = content.size();
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (!_data) {
+            return;
+        }
+#ifndef _WIN32
+        munmap(const_cast<char *>(_data), _size);
+#else
+        delete[] _data;
+#endif
+    }
+
+    std::string_view view() const {
+        return {_data, _size};
+    }
+
+    bool empty() const {
+        return !_size;
+    }
+
+private:
+    const char *_data = nullptr;
+    size_t _size = 0;
+};
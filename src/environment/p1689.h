@@ -0,0 +1,274 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "environment/prescan.h"
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! A minimal json value, only what is needed to read dependency files from
+//! compilers. Numbers and booleans is kept as text
+struct Json {
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Type type = Null;
+    std::string value; // For strings, numbers and booleans
+    std::vector<Json> array;
+    std::vector<std::pair<std::string, Json>> object;
+
+    //! Get a member of a object, or null if it does not exist
+    const Json &operator[](const std::string &key) const {
+        static const Json null;
+        for (auto &member : object) {
+            if (member.first == key) {
+                return member.second;
+            }
+        }
+        return null;
+    }
+};
+
+namespace json {
+
+//! Quote and escape a string to use in a json file
+inline std::string quote(const std::string &str) {
+    std::string ret = "\"";
+    for (auto c : str) {
+        switch (c) {
+        case '"':
+            ret += "\\\"";
+            break;
+        case '\\':
+            ret += "\\\\";
+            break;
+        case '\n':
+            ret += "\\n";
+            break;
+        case '\t':
+            ret += "\\t";
+            break;
+        default:
+            ret += c;
+        }
+    }
+    return ret + "\"";
+}
+
+namespace impl {
+
+inline void skipSpace(const std::string &text, size_t &i) {
+    while (i < text.size() && isspace(static_cast<unsigned char>(text[i]))) {
+        ++i;
+    }
+}
+
+inline bool parseString(const std::string &text, size_t &i, std::string &str) {
+    if (i >= text.size() || text[i] != '"') {
+        return false;
+    }
+    for (++i; i < text.size(); ++i) {
+        auto c = text[i];
+        if (c == '"') {
+            ++i;
+            return true;
+        }
+        if (c != '\\') {
+            str += c;
+            continue;
+        }
+        if (++i >= text.size()) {
+            return false;
+        }
+        switch (text[i]) {
+        case 'n':
+            str += '\n';
+            break;
+        case 't':
+            str += '\t';
+            break;
+        case 'r':
+            str += '\r';
+            break;
+        case 'b':
+            str += '\b';
+            break;
+        case 'f':
+            str += '\f';
+            break;
+        case 'u': {
+            // Paths and module names is expected to be ascii
+            if (i + 4 >= text.size()) {
+                return false;
+            }
+            auto code = std::strtol(text.substr(i + 1, 4).c_str(), nullptr, 16);
+            str += (code < 0x80) ? static_cast<char>(code) : '?';
+            i += 4;
+            break;
+        }
+        default:
+            str += text[i];
+        }
+    }
+    return false;
+}
+
+inline bool parseValue(const std::string &text, size_t &i, Json &value) {
+    skipSpace(text, i);
+    if (i >= text.size()) {
+        return false;
+    }
+
+    auto c = text[i];
+    if (c == '{') {
+        value.type = Json::Object;
+        ++i;
+        skipSpace(text, i);
+        if (i < text.size() && text[i] == '}') {
+            ++i;
+            return true;
+        }
+        while (true) {
+            std::pair<std::string, Json> member;
+            skipSpace(text, i);
+            if (!parseString(text, i, member.first)) {
+                return false;
+            }
+            skipSpace(text, i);
+            if (i >= text.size() || text[i] != ':') {
+                return false;
+            }
+            ++i;
+            if (!parseValue(text, i, member.second)) {
+                return false;
+            }
+            value.object.push_back(std::move(member));
+            skipSpace(text, i);
+            if (i < text.size() && text[i] == ',') {
+                ++i;
+            }
+            else if (i < text.size() && text[i] == '}') {
+                ++i;
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+    else if (c == '[') {
+        value.type = Json::Array;
+        ++i;
+        skipSpace(text, i);
+        if (i < text.size() && text[i] == ']') {
+            ++i;
+            return true;
+        }
+        while (true) {
+            value.array.emplace_back();
+            if (!parseValue(text, i, value.array.back())) {
+                return false;
+            }
+            skipSpace(text, i);
+            if (i < text.size() && text[i] == ',') {
+                ++i;
+            }
+            else if (i < text.size() && text[i] == ']') {
+                ++i;
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+    else if (c == '"') {
+        value.type = Json::String;
+        return parseString(text, i, value.value);
+    }
+    else {
+        auto end = text.find_first_of(",]} \t\r\n", i);
+        value.value = text.substr(i, end - i);
+        i = (end == std::string::npos) ? text.size() : end;
+        if (value.value == "null") {
+            value.type = Json::Null;
+        }
+        else if (value.value == "true" || value.value == "false") {
+            value.type = Json::Bool;
+        }
+        else if (!value.value.empty() &&
+                 (isdigit(static_cast<unsigned char>(value.value.front())) ||
+                  value.value.front() == '-')) {
+            value.type = Json::Number;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+}
+
+} // namespace impl
+
+//! Returns nothing if the text is not valid json
+inline std::optional<Json> parse(const std::string &text) {
+    Json value;
+    size_t i = 0;
+    if (!impl::parseValue(text, i, value)) {
+        return {};
+    }
+    impl::skipSpace(text, i);
+    if (i != text.size()) {
+        return {};
+    }
+    return value;
+}
+
+} // namespace json
+
+//! Read the module dependencies from a P1689 file, the format written by
+//! clang-scan-deps -format=p1689 and gcc -fdeps-format=p1689r5
+//!
+//! @return the modules provided and required by each file, with the primary
+//! output of the file as key (for example the .o or .pcm file). Includes
+//! is not part of the format and is left empty. Empty if the file could not
+//! be read
+inline std::map<std::string, PrescanResult> parseP1689(
+    const std::string &text) {
+    std::map<std::string, PrescanResult> ret;
+
+    auto root = json::parse(text);
+    if (!root) {
+        return {};
+    }
+
+    for (auto &rule : (*root)["rules"].array) {
+        auto &output = rule["primary-output"].value;
+        if (output.empty()) {
+            continue;
+        }
+
+        auto &res = ret[output];
+        for (auto &provided : rule["provides"].array) {
+            auto &name = provided["logical-name"].value;
+            if (!name.empty()) {
+                res.exportModules.push_back(name);
+            }
+        }
+        for (auto &required : rule["requires"].array) {
+            auto &name = required["logical-name"].value;
+            // Header units is found with the includes instead
+            auto isHeaderUnit =
+                required["lookup-method"].value.compare(0, 7, "include") == 0;
+            if (!name.empty() && !isHeaderUnit) {
+                res.imports.push_back(name);
+            }
+        }
+    }
+
+    return ret;
+}
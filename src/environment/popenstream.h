@@ -31,6 +31,7 @@ private:
                 return std::char_traits<char>::to_int_type(*this->gptr());
             }
             else {
+                pclose(pfile); // Do not leave the process as a zombie
                 pfile = nullptr;
                 return std::char_traits<char>::eof();
             }
@@ -2,73 +2,484 @@
 
 #pragma once
 
+#include "environment/ifiles.h"
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 struct PrescanResult {
     std::vector<std::string> includes;
+    // Found in -isystem or -idirafter paths, they is not dependencies
     std::vector<std::string> systemHeaders;
     std::vector<std::string> imports;
     std::vector<std::string> exportModules;
 };
 
-PrescanResult prescan(std::istream &input) {
-    PrescanResult res;
+//! Includes and module declarations found in a single file
+struct SourceDirectives {
+    struct Include {
+        std::string name;
+        bool isAngled = false; // <file> instead of "file"
+    };
+
+    std::vector<Include> includes;
+    std::vector<std::string> imports;
+    std::vector<std::string> exportModules;
+};
+
+//! A ' inside a number, as in 1'000'000, does not start a character literal
+inline bool isDigitSeparator(const std::string &line, size_t i) {
+    auto begin = i;
+    while (begin > 0 && (isalnum(static_cast<unsigned char>(line[begin - 1])) ||
+                         line[begin - 1] == '_' || line[begin - 1] == '.' ||
+                         line[begin - 1] == '\'')) {
+        --begin;
+    }
+    // A prefix like in u8'a' is not a number
+    return begin < i && isdigit(static_cast<unsigned char>(line[begin]));
+}
+
+//! Find includes and module declarations in source code, without expanding
+//! macros. Comments, strings and blocks in #if 0 is skipped. Includes with
+//! macros is ignored
+//!
+//! Other conditions is treated as true, so both branches of for example a
+//! #ifdef and its #else is scanned. The result can then have includes that
+//! the compiler does not use, but does not miss any. They is only used until
+//! the file is compiled and the compiler lists the real dependencies
+inline SourceDirectives scanDirectives(std::istream &input) {
+    SourceDirectives res;
+
+    // Remove comments and join lines ending with backslash, so that each
+    // line is a complete directive or statement
+    std::vector<std::string> lines(1);
+    bool isInComment = false;
+    for (std::string line; getline(input, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        auto &current = lines.back();
+        for (size_t i = 0; i < line.size(); ++i) {
+            auto c = line[i];
+            auto next = (i + 1 < line.size()) ? line[i + 1] : '\0';
+            if (isInComment) {
+                if (c == '*' && next == '/') {
+                    isInComment = false;
+                    ++i;
+                }
+            }
+            else if (c == '/' && next == '/') {
+                break;
+            }
+            else if (c == '/' && next == '*') {
+                isInComment = true;
+                current += ' ';
+                ++i;
+            }
+            else if (c == '\'' && isDigitSeparator(line, i)) {
+                current += c;
+            }
+            else if (c == '"' || c == '\'') {
+                // Include names in quotes is kept, other strings is removed
+                auto end = i + 1;
+                for (; end < line.size() && line[end] != c; ++end) {
+                    if (line[end] == '\\') {
+                        ++end;
+                    }
+                }
+                current.append(line, i, end - i + 1);
+                i = end;
+            }
+            else {
+                current += c;
+            }
+        }
+        if (!current.empty() && current.back() == '\\') {
+            current.pop_back();
+        }
+        else {
+            lines.emplace_back();
+        }
+    }
+
+    auto trim = [](const std::string &str) {
+        auto begin = str.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            return std::string{};
+        }
+        auto end = str.find_last_not_of(" \t;");
+        return str.substr(begin, end - begin + 1);
+    };
+
+    // Name in "" or <> first in text
+    auto quoted = [&trim](const std::string &text, bool &isAngled) {
+        auto str = trim(text);
+        if (str.size() < 2) {
+            return std::string{};
+        }
+        isAngled = str.front() == '<';
+        auto end = str.find(isAngled ? '>' : '"', 1);
+        if ((!isAngled && str.front() != '"') || end == std::string::npos) {
+            return std::string{};
+        }
+        return str.substr(1, end - 1);
+    };
 
-    auto addUnique = [](std::vector<std::string> &collection, auto &&value) {
+    auto addUnique = [](std::vector<std::string> &collection,
+                        std::string value) {
         if (std::find(collection.begin(), collection.end(), value) ==
             collection.end()) {
-            collection.emplace_back(move(value));
+            collection.push_back(std::move(value));
         }
     };
 
-    for (std::string line; getline(input, line);) {
-        if (line.size() < 3) {
+    // One element for each #if, true if the lines is skipped
+    std::vector<bool> skipped;
+    std::string moduleName;
+    for (auto &line : lines) {
+        auto str = trim(line);
+        if (str.empty()) {
             continue;
         }
 
-        if (line.front() == '#' && line[1] == ' ') {
-            auto begin = line.find("\"");
-            auto end = line.rfind("\"");
+        bool isSkipped = !skipped.empty() && skipped.back();
 
-            if (begin == std::string::npos) {
-                continue;
+        if (str.front() == '#') {
+            std::istringstream ss(str.substr(1));
+            std::string directive;
+            ss >> directive;
+            std::string rest;
+            getline(ss, rest);
+            rest = trim(rest);
+
+            if (directive == "if" || directive == "ifdef" ||
+                directive == "ifndef") {
+                skipped.push_back(isSkipped ||
+                                  (directive == "if" && rest == "0"));
+            }
+            else if (directive == "elif" || directive == "else") {
+                if (!skipped.empty()) {
+                    bool isParentSkipped =
+                        skipped.size() > 1 && skipped[skipped.size() - 2];
+                    skipped.back() =
+                        isParentSkipped ||
+                        (directive == "elif" && rest == "0");
+                }
+            }
+            else if (directive == "endif") {
+                if (!skipped.empty()) {
+                    skipped.pop_back();
+                }
             }
+            else if (!isSkipped &&
+                     (directive == "include" || directive == "include_next")) {
+                SourceDirectives::Include include;
+                include.name = quoted(rest, include.isAngled);
+                if (!include.name.empty()) {
+                    res.includes.push_back(std::move(include));
+                }
+            }
+            continue;
+        }
 
-            auto name = line.substr(begin + 1, end - begin - 1);
+        if (isSkipped) {
+            continue;
+        }
 
-            if (name.empty()) {
-                continue;
+        std::istringstream ss(str);
+        std::string word;
+        ss >> word;
+        bool isExport = word == "export";
+        if (isExport) {
+            ss >> word;
+        }
+        std::string name;
+        ss >> name;
+
+        if (word == "module" && !name.empty()) {
+            moduleName = name.substr(0, name.find(':'));
+            if (isExport) {
+                addUnique(res.exportModules, name);
+            }
+            else if (moduleName == name) {
+                // A implementation unit depends on the interface, but a
+                // partition implementation unit does not
+                addUnique(res.imports, name);
+            }
+        }
+        else if (word == "import" && !name.empty()) {
+            if (name.front() == ':') {
+                addUnique(res.imports, moduleName + name);
+            }
+            else if (name.front() != '<' && name.front() != '"') {
+                addUnique(res.imports, name);
+            }
+        }
+    }
+
+    return res;
+}
+
+//! Make a path as short as possible, for example "src/../include/a.h" to
+//! "include/a.h"
+inline std::string normalizePath(const std::string &path) {
+    std::vector<std::string> parts;
+    std::istringstream ss(path);
+    for (std::string part; getline(ss, part, '/');) {
+        if (part.empty() || part == ".") {
+            continue;
+        }
+        if (part == ".." && !parts.empty() && parts.back() != "..") {
+            parts.pop_back();
+        }
+        else {
+            parts.push_back(part);
+        }
+    }
+
+    std::string ret = (!path.empty() && path.front() == '/') ? "/" : "";
+    for (auto &part : parts) {
+        if (!ret.empty() && ret.back() != '/') {
+            ret += '/';
+        }
+        ret += part;
+    }
+    return ret;
+}
+
+//! Where a included header was found
+struct FoundHeader {
+    std::string path;      // Empty if the header was not found
+    bool isSystem = false; // Found in a -isystem or -idirafter path
+};
+
+//! Remembers the directives of files and where headers was found, so that
+//! each header only is read and searched for once, even if it is included
+//! from thousands of source files
+//!
+//! Paths is relative to the current directory, so the cache is owned by
+//! IFiles and cleared when the directory changes
+class ScanCache {
+public:
+    using DirectivesPtr = std::shared_ptr<const SourceDirectives>;
+
+    //! Get the directives of a file, or call scan and remember the result
+    template <typename ScanT>
+    DirectivesPtr directives(const std::string &path, ScanT scan) {
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto f = _directives.find(path);
+            if (f != _directives.end()) {
+                return f->second;
+            }
+        }
+
+        auto directives = std::make_shared<const SourceDirectives>(scan());
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        return _directives.emplace(path, std::move(directives)).first->second;
+    }
+
+    //! Get where a header was found, or call find and remember the result
+    //! Headers that is not found is also remembered, with a empty path
+    template <typename FindT>
+    FoundHeader header(const std::string &key, FindT find) {
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto f = _headers.find(key);
+            if (f != _headers.end()) {
+                return f->second;
+            }
+        }
+
+        auto header = find();
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        return _headers.emplace(key, std::move(header)).first->second;
+    }
+
+    //! Forget a file that is changed. It may also be a new header
+    void invalidate(const std::string &path) {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _directives.erase(path);
+        _headers.clear();
+    }
+
+    void clear() {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _directives.clear();
+        _headers.clear();
+    }
+
+private:
+    std::shared_mutex _mutex;
+    std::unordered_map<std::string, DirectivesPtr> _directives;
+    std::unordered_map<std::string, FoundHeader> _headers;
+};
+
+//! Finds the dependencies of a source file without running the compiler
+//!
+//! Headers is searched for in the same way as the compiler does, in the
+//! directory of the including file and in the include paths from the flags.
+//! Headers found in -isystem and -idirafter paths is system headers, that
+//! is not scanned or tracked, like with -MMD. Other headers is scanned
+//! recursively, also when the include path is absolute. Headers that is not
+//! found is expected to be in the compilers own paths and is ignored.
+//!
+//! The result can miss headers, so it is only used until the file is
+//! compiled. Then it is replaced by the dependencies from the compiler
+class SourceScanner {
+public:
+    //! @param flags compiler flags, include paths is taken from -I, -iquote,
+    //! -isystem, -idirafter and /I followed by a separate path
+    SourceScanner(const std::string &flags) {
+        std::istringstream ss(flags);
+        std::vector<std::string> words;
+        for (std::string word; ss >> word;) {
+            words.push_back(word);
+        }
+
+        auto addPath = [](std::vector<std::string> &paths, std::string path) {
+            if (!path.empty()) {
+                paths.push_back(normalizePath(path));
+            }
+        };
+
+        for (size_t i = 0; i < words.size(); ++i) {
+            auto &word = words[i];
+            auto next = (i + 1 < words.size()) ? words[i + 1] : "";
+            for (auto prefix : {"-I", "/I", "-iquote", "-isystem",
+                                "-idirafter"}) {
+                auto length = std::string{prefix}.size();
+                if (word.compare(0, length, prefix) != 0) {
+                    continue;
+                }
+                if (prefix[0] == '/' && word.size() > length) {
+                    // Matmake writes /I and the path as separate words for
+                    // msvc. Any other word could be a path like /Include
+                    continue;
+                }
+                auto &paths = (std::string{prefix} == "-iquote")
+                                  ? _quotePaths
+                                  : (prefix[1] == 'i') ? _systemIncludePaths
+                                                       : _includePaths;
+                if (word.size() > length) {
+                    addPath(paths, word.substr(length));
+                }
+                else {
+                    addPath(paths, next);
+                    ++i;
+                }
+                break;
             }
-            if (name.front() == '<') {
+        }
+
+        // Headers found with one set of include paths can not be reused
+        // with another
+        for (auto paths :
+             {&_quotePaths, &_includePaths, &_systemIncludePaths}) {
+            for (auto &path : *paths) {
+                _cacheKey += path + "\n";
+            }
+            _cacheKey += "\n";
+        }
+    }
+
+    PrescanResult scan(const IFiles &files, const std::string &path) const {
+        PrescanResult res;
+        std::set<std::string> visited = {path};
+        scan(files, path, res, visited);
+
+        auto directives = this->directives(files, path);
+        res.imports = directives->imports;
+        res.exportModules = directives->exportModules;
+        return res;
+    }
+
+private:
+    void scan(const IFiles &files,
+              const std::string &path,
+              PrescanResult &res,
+              std::set<std::string> &visited) const {
+        auto directory = path.substr(0, path.rfind('/') + 1);
+
+        auto directives = this->directives(files, path);
+        for (auto &include : directives->includes) {
+            auto header = find(files, include, directory);
+            if (header.path.empty() || !visited.insert(header.path).second) {
                 continue;
             }
-            else if (name.front() == '/') {
-                addUnique(res.systemHeaders, move(name));
+            if (header.isSystem) {
+                res.systemHeaders.push_back(header.path);
             }
             else {
-                addUnique(res.includes, move(name));
+                res.includes.push_back(header.path);
+                scan(files, header.path, res, visited);
+            }
+        }
+    }
+
+    //! Returns where a header is, with a empty path if not found
+    FoundHeader find(const IFiles &files,
+                     const SourceDirectives::Include &include,
+                     const std::string &directory) const {
+        // The directory of the including file is not searched for <file>
+        auto key = _cacheKey + (include.isAngled ? "<" : directory + "\"") +
+                   include.name;
+        return files.scanCache().header(
+            key, [&] { return search(files, include, directory); });
+    }
+
+    FoundHeader search(const IFiles &files,
+                       const SourceDirectives::Include &include,
+                       const std::string &directory) const {
+        if (include.name.front() == '/') {
+            if (files.getTimeChanged(include.name)) {
+                return {include.name, false};
             }
+            return {};
         }
-        else if (line.rfind("import ", 0) != std::string::npos) {
-            auto moduleName = line.substr(7);
-            auto f = moduleName.rfind(";");
-            if (f != std::string::npos) {
-                moduleName.erase(f, moduleName.size());
-                addUnique(res.imports, move(moduleName));
+
+        // -iquote paths is only searched for "file"
+        auto candidates = std::vector<FoundHeader>{};
+        if (!include.isAngled) {
+            candidates.push_back({directory + include.name, false});
+            for (auto &path : _quotePaths) {
+                candidates.push_back({path + "/" + include.name, false});
             }
         }
-        else if (line.rfind("export module ", 0) != std::string::npos) {
-            auto moduleName = line.substr(14);
-            auto f = moduleName.rfind(";");
-            if (f != std::string::npos) {
-                moduleName.erase(f, moduleName.size());
-                addUnique(res.exportModules, move(moduleName));
+        for (auto &path : _includePaths) {
+            candidates.push_back({path + "/" + include.name, false});
+        }
+        for (auto &path : _systemIncludePaths) {
+            candidates.push_back({path + "/" + include.name, true});
+        }
+
+        for (auto &candidate : candidates) {
+            candidate.path = normalizePath(candidate.path);
+            if (files.getTimeChanged(candidate.path)) {
+                return candidate;
             }
         }
+        return {};
     }
 
-    return res;
-}
+    static ScanCache::DirectivesPtr directives(const IFiles &files,
+                                               const std::string &path) {
+        return files.scanCache().directives(path, [&] {
+            auto file = files.openRead(path);
+            return scanDirectives(file);
+        });
+    }
+
+    std::vector<std::string> _quotePaths; // Only for "file"
+    std::vector<std::string> _includePaths;
+    std::vector<std::string> _systemIncludePaths;
+    std::string _cacheKey; // The include paths
+};
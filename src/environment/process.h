@@ -0,0 +1,339 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "environment/globals.h"
+#include "environment/ifiles.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+//! Keeps track of the commands that is currently running, so that they can
+//! be stopped at once when the build fails or is interrupted
+//!
+//! Each command runs in its own process group, so that the compiler and
+//! every process started by it is stopped together. The list is lock free
+//! since it is used from a signal handler.
+class RunningProcesses {
+public:
+    //! @return false if there is no free slot, then the process can not be
+    //!         stopped by killAll()
+    bool add(pid_t pid) {
+        for (auto &slot : _processes) {
+            pid_t empty = 0;
+            if (slot.compare_exchange_strong(empty, pid)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void remove(pid_t pid) {
+        for (auto &slot : _processes) {
+            pid_t expected = pid;
+            if (slot.compare_exchange_strong(expected, 0)) {
+                return;
+            }
+        }
+    }
+
+    //! Send a signal to all running commands
+    //! Safe to call from a signal handler
+    void killAll(int signal = SIGTERM) {
+        for (auto &slot : _processes) {
+            if (auto pid = slot.load()) {
+                ::kill(-pid, signal);
+            }
+        }
+    }
+
+private:
+    std::array<std::atomic<pid_t>, 1024> _processes{};
+};
+
+inline RunningProcesses runningProcesses;
+
+//! Stop the build and all running commands when ctrl-c is pressed
+//! A second ctrl-c quits immediately
+inline void installInterruptHandler() {
+    struct sigaction action = {};
+    action.sa_handler = [](int) {
+        globals.bailout = true;
+        runningProcesses.killAll();
+        signal(SIGINT, SIG_DFL);
+    };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+}
+#else
+inline void installInterruptHandler() {}
+#endif
+
+//! Split a command into arguments the same way as the shell does, so that
+//! the command can be started without a shell
+//! @return false if the command uses shell features like variables, pipes
+//!         or redirections, then the command needs to run in a shell
+inline bool splitCommand(const std::string &command,
+                         std::vector<std::string> &args) {
+    args.clear();
+    std::string arg;
+    bool isInArg = false;
+
+    for (size_t i = 0; i < command.size(); ++i) {
+        auto c = command[i];
+        if (c == '\n') {
+            return false; // Separates commands in a shell
+        }
+        else if (c == ' ' || c == '\t') {
+            if (isInArg) {
+                args.push_back(std::move(arg));
+                arg.clear();
+                isInArg = false;
+            }
+        }
+        else if (c == '\'') {
+            // Everything in single quotes is literal, eg '${ORIGIN}'
+            auto end = command.find('\'', i + 1);
+            if (end == std::string::npos) {
+                return false;
+            }
+            arg.append(command, i + 1, end - i - 1);
+            i = end;
+            isInArg = true;
+        }
+        else if (c == '"') {
+            for (++i; i < command.size() && command[i] != '"'; ++i) {
+                if (command[i] == '$' || command[i] == '`' ||
+                    command[i] == '\\') {
+                    return false;
+                }
+                arg += command[i];
+            }
+            if (i == command.size()) {
+                return false;
+            }
+            isInArg = true;
+        }
+        else if (c == '\\') {
+            if (++i == command.size() || command[i] == '\n') {
+                return false;
+            }
+            arg += command[i];
+            isInArg = true;
+        }
+        else if ((c && strchr("|&;<>()$`*?[]{}!", c)) ||
+                 (!isInArg && (c == '#' || c == '~')) ||
+                 (c == '=' && args.empty())) {
+            // Pipes, redirections, variables, globs, comments or variable
+            // assignments before the command
+            return false;
+        }
+        else {
+            arg += c;
+            isInArg = true;
+        }
+    }
+
+    if (isInArg) {
+        args.push_back(std::move(arg));
+    }
+    return !args.empty();
+}
+
+#ifndef _WIN32
+//! Create a pipe that is closed on exec, so that processes started from other
+//! threads does not keep it open
+//! @return true on success
+inline bool createPipe(int fds[2]) {
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC) == 0;
+#else
+    // Not atomic, but pipe2 is not available on all systems
+    if (pipe(fds)) {
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+#endif
+}
+#endif
+
+//! Stop all commands that is running, for example when the build has failed
+inline void killRunningProcesses() {
+#ifndef _WIN32
+    runningProcesses.killAll();
+#endif
+}
+
+//! Run a command and return the exit code, the output to stdout and stderr
+//! and how much memory the command used
+inline PopenResult runCommand(const std::string &command) {
+    PopenResult ret;
+
+#ifdef _WIN32
+    FILE *file = _popen((command + " 2>&1").c_str(), "r");
+
+    if (!file) {
+        return {-1, "failed to execute command " + command};
+    }
+
+    std::array<char, 4096> buffer;
+
+    while (fgets(buffer.data(), buffer.size(), file)) {
+        ret.second += buffer.data();
+    }
+
+    ret.first = _pclose(file);
+#else
+    // Starting the command directly saves starting a shell for each
+    // command, that is only done when the command needs it
+    std::vector<std::string> args;
+    if (!splitCommand(command, args)) {
+        args = {"sh", "-c", command};
+    }
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    int outFds[2];
+    int errFds[2];
+    if (!createPipe(outFds)) {
+        return {-1, "failed to create pipe for command " + command};
+    }
+    if (!createPipe(errFds)) {
+        close(outFds[0]);
+        close(outFds[1]);
+        return {-1, "failed to create pipe for command " + command};
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    // Background process groups is stopped if they read from the terminal,
+    // so there is no input
+    posix_spawn_file_actions_addopen(
+        &actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, outFds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, errFds[1], STDERR_FILENO);
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    pid_t pid = 0;
+    auto error = posix_spawnp(
+        &pid, argv.front(), &actions, &attributes, argv.data(), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    close(outFds[1]);
+    close(errFds[1]);
+
+    if (error) {
+        close(outFds[0]);
+        close(errFds[0]);
+        // Same exit code as the shell uses for commands that is not found
+        ret.first = 127;
+        ret.errorOutput = "failed to execute command " + command + ": " +
+                          strerror(error) + "\n";
+        return ret;
+    }
+
+    if (!runningProcesses.add(pid)) {
+        ret.errorOutput += "warning: too many running commands, " + command +
+                           " will not be stopped if the build fails\n";
+    }
+    if (globals.bailout) {
+        // The build was stopped while the process was started
+        ::kill(-pid, SIGTERM);
+    }
+
+    // Read from both pipes as the output comes, otherwise the command could
+    // be blocked writing to a full pipe
+    std::array<pollfd, 2> pollFds = {{
+        {outFds[0], POLLIN, 0},
+        {errFds[0], POLLIN, 0},
+    }};
+    std::array<std::string *, 2> outputs = {&ret.second, &ret.errorOutput};
+    std::vector<char> buffer(1 << 16);
+    size_t numberOfOpenPipes = pollFds.size();
+
+    while (numberOfOpenPipes) {
+        if (poll(pollFds.data(), pollFds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (size_t i = 0; i < pollFds.size(); ++i) {
+            auto &pfd = pollFds[i];
+            if (pfd.fd < 0 || !pfd.revents) {
+                continue;
+            }
+            auto size = read(pfd.fd, buffer.data(), buffer.size());
+            if (size > 0) {
+                outputs[i]->append(buffer.data(), static_cast<size_t>(size));
+            }
+            else if (size == 0 || errno != EINTR) {
+                close(pfd.fd);
+                pfd.fd = -1; // Ignored by poll
+                --numberOfOpenPipes;
+            }
+        }
+    }
+    for (auto &pfd : pollFds) {
+        if (pfd.fd >= 0) {
+            close(pfd.fd);
+        }
+    }
+
+    int status = 0;
+    struct rusage usage = {};
+    // Wait without removing the process, so that the pid can not be reused
+    // by another process before it is removed from the running processes
+    siginfo_t info;
+    while (waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOWAIT) <
+               0 &&
+           errno == EINTR) {
+    }
+    runningProcesses.remove(pid);
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+    }
+
+    if (WIFEXITED(status)) {
+        ret.first = WEXITSTATUS(status);
+    }
+    else {
+        ret.first = -1; // Killed by a signal
+    }
+
+#ifdef __APPLE__
+    // ru_maxrss is in bytes on macOS
+    ret.peakMemory = usage.ru_maxrss / (1024 * 1024);
+#else
+    // ru_maxrss is in kilobytes on linux and the BSDs
+    ret.peakMemory = usage.ru_maxrss / 1024;
+#endif
+#endif
+
+    return ret;
+}
@@ -0,0 +1,59 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include "environment/ifiles.h"
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+//! Remembers when files was changed, so that each file only needs to be
+//! checked once, even if it is included from thousands of source files
+//!
+//! Files written by matmake, or by commands started by matmake, must be
+//! invalidated. Files that does not exist is not cached
+class StatCache {
+public:
+    //! Get the cached time of a file, or call getTime and remember the result
+    template <typename GetTimeT>
+    FileTimeT get(const std::string &path, GetTimeT getTime) {
+        size_t generation = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto f = _times.find(path);
+            if (f != _times.end()) {
+                return f->second;
+            }
+            generation = _generation;
+        }
+
+        // Two threads may stat the same file, that is harmless
+        auto time = getTime(path);
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        // The file may have been written while it was checked. Missing files
+        // is not remembered since they is probably about to be created
+        if (generation == _generation && time) {
+            _times[path] = time;
+        }
+        return time;
+    }
+
+    void invalidate(const std::string &path) {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _times.erase(path);
+        ++_generation;
+    }
+
+    //! Forget everything, for example when the working directory changes
+    void clear() {
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _times.clear();
+        ++_generation;
+    }
+
+private:
+    std::shared_mutex _mutex;
+    std::unordered_map<std::string, FileTimeT> _times;
+    size_t _generation = 0; // Changed every time something is invalidated
+};
@@ -9,75 +9,430 @@
 
 #include "dependency/ibuildrule.h"
 #include "dependency/idependency.h"
+#include "environment/admission.h"
+#include "environment/buildlog.h"
+#include "environment/buildstatus.h"
 #include "environment/ifiles.h"
 #include "environment/ithreadpool.h"
+#include "environment/process.h"
 #include "main/mdebug.h"
 #include "main/merror.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-class ThreadPool : std::queue<IDependency *>, public IThreadPool {
-    std::mutex workMutex;
-    std::mutex workAssignMutex;
-    std::atomic<size_t> numberOfActiveThreads;
+//! Orders tasks so that the task with the longest path of remaining work
+//! after it is started first
+struct CriticalPathOrder {
+    //! Estimated time in milliseconds from when the task is started to when
+    //! every task waiting for it can be finished
+    std::unordered_map<const IDependency *, long> criticalPath;
+
+    long weight(const IDependency *d) const {
+        auto f = criticalPath.find(d);
+        return (f != criticalPath.end()) ? f->second : 0;
+    }
+
+    bool operator()(const IDependency *a, const IDependency *b) const {
+        return weight(a) < weight(b);
+    }
+};
+
+class ThreadPool
+    : std::priority_queue<IDependency *,
+                          std::vector<IDependency *>,
+                          CriticalPathOrder>,
+      public IThreadPool {
+    //! Tasks owned by a single worker, ordered by critical path. Other
+    //! workers steal the most important task when they run out of work
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<IDependency *> tasks;
+    };
+
+    //! Set on worker threads to find the queue of the current worker
+    //! (zero initialized since it is static)
+    struct CurrentWorker {
+        ThreadPool *pool;
+        WorkerQueue *queue;
+    };
+    inline static thread_local CurrentWorker currentWorker;
+
+    std::mutex workAssignMutex; // Protects the shared queue
+    std::condition_variable workCondition;
+
+    // Threads that is started once and used both for the build and for work
+    // that is done for all files before the build, see runOnWorkers()
+    std::vector<std::thread> workers;
+    std::mutex runMutex;
+    std::condition_variable runCondition;
+    std::condition_variable runFinishedCondition;
+    std::function<void(size_t)> runFunction;
+    size_t runGeneration = 0;     // Increased for each call to runOnWorkers
+    size_t numberOfRunWorkers = 0; // Workers that takes part in the call
+    size_t numberOfRunningWorkers = 0;
+    bool isShuttingDown = false;
+
+    std::vector<std::unique_ptr<WorkerQueue>> workerQueues;
+    std::atomic<size_t> numberOfQueuedTasks{0};
+    // Tasks that is queued or running, a single counter so that a task is
+    // never missed when it moves from the queue to a worker
+    std::atomic<size_t> numberOfUnfinishedTasks{0};
+    std::atomic<size_t> numberOfSleepingWorkers{0};
+    std::atomic<size_t> numberOfFinishedJobs{0}; // Frees admission resources
+    AdmissionControl admission;
     int maxTasks = 0;
-    int taskFinished = 0;
-    int lastProgress = 0;
+    BuildStatus status;
+    long totalWork = 0;       // Expected time in ms for all tasks together
+    long defaultDuration = 1; // Expected time for tasks never built before
+    std::mutex failedMutex;
+    std::vector<IDependency *> failedTasks;
 
 public:
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(runMutex);
+            isShuttingDown = true;
+        }
+        runCondition.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
     void addTask(IDependency *t) override {
-        workAssignMutex.lock();
-        push(t);
-        workAssignMutex.unlock();
-        workMutex.try_lock();
-        workMutex.unlock();
+        ++numberOfUnfinishedTasks;
+        if (currentWorker.pool == this) {
+            // Keep tasks unlocked by a worker on the same worker, it is
+            // probably going to use the file that was just built
+            pushLocal(*currentWorker.queue, t);
+        }
+        else {
+            std::lock_guard<std::mutex> guard(workAssignMutex);
+            push(t);
+            ++numberOfQueuedTasks;
+        }
+        wakeWorkers(false);
+    }
+
+    void print(std::string text, bool isError = false) override {
+        status.print(std::move(text), isError);
     }
 
     void addTaskCount() {
         ++maxTasks;
     }
 
+    //! Call f for each element in a container on as many workers as the
+    //! build uses, and wait for all calls to finish. Used for work that is
+    //! not build tasks, for example to scan or check which files that is
+    //! dirty
+    //! @throws the first exception thrown from f
+    template <typename ContainerT, typename FunctionT>
+    void forEach(ContainerT &container, FunctionT f) {
+        auto numberOfThreads =
+            std::min<size_t>(globals.numberOfThreads, container.size());
+        if (numberOfThreads <= 1) {
+            for (auto &element : container) {
+                f(element);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next{0};
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        runOnWorkers(numberOfThreads, [&](size_t) {
+            for (size_t i = next++; i < container.size(); i = next++) {
+                try {
+                    f(container[i]);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> guard(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    next = container.size();
+                }
+            }
+        });
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    //! Call f(index) once on each of the first numberOfWorkers workers and
+    //! wait for all calls to finish. Workers is started the first time they
+    //! are needed and then kept until the pool is destroyed
+    void runOnWorkers(size_t numberOfWorkers, std::function<void(size_t)> f) {
+        std::unique_lock<std::mutex> lock(runMutex);
+        while (workers.size() < numberOfWorkers) {
+            workers.emplace_back(
+                [this, index = workers.size(), generation = runGeneration] {
+                    workerLoop(index, generation);
+                });
+        }
+
+        runFunction = std::move(f);
+        numberOfRunWorkers = numberOfWorkers;
+        numberOfRunningWorkers = numberOfWorkers;
+        ++runGeneration;
+        runCondition.notify_all();
+        runFinishedCondition.wait(
+            lock, [this] { return numberOfRunningWorkers == 0; });
+        runFunction = nullptr;
+    }
+
+    //! What a worker thread does between the calls to runOnWorkers()
+    //! @param generation the runGeneration when the worker was started
+    void workerLoop(size_t index, size_t generation) {
+        std::unique_lock<std::mutex> lock(runMutex);
+        while (true) {
+            runCondition.wait(lock, [&] {
+                return isShuttingDown || runGeneration != generation;
+            });
+            if (isShuttingDown) {
+                return;
+            }
+            generation = runGeneration;
+            if (index >= numberOfRunWorkers) {
+                continue;
+            }
+
+            // runFunction is not changed until all workers is finished
+            lock.unlock();
+            runFunction(index);
+            lock.lock();
+
+            if (--numberOfRunningWorkers == 0) {
+                runFinishedCondition.notify_all();
+            }
+        }
+    }
+
+    //! Returns true when there is nothing more to do for the workers
+    bool isFinished() const {
+        return globals.bailout || numberOfUnfinishedTasks == 0;
+    }
+
+    //! Wake sleeping workers if there is any
+    void wakeWorkers(bool all) {
+        if (numberOfSleepingWorkers == 0) {
+            return;
+        }
+        {
+            // Make sure that no worker is between checking for work and
+            // starting to wait
+            std::lock_guard<std::mutex> guard(workAssignMutex);
+        }
+        if (all) {
+            workCondition.notify_all();
+        }
+        else {
+            workCondition.notify_one();
+        }
+    }
+
+    //! Find a new task, the most important of the first in the workers own
+    //! queue and the first in the shared queue. If both is empty the most
+    //! important task of the other workers is stolen
+    //! @return nullptr if no task is found
+    IDependency *takeTask(size_t index) {
+        auto &ownQueue = *workerQueues.at(index);
+        {
+            // The own queue is always locked before the shared queue
+            std::lock_guard<std::mutex> ownGuard(ownQueue.mutex);
+            std::lock_guard<std::mutex> guard(workAssignMutex);
+            auto &tasks = ownQueue.tasks;
+            if (!tasks.empty() && (empty() || !comp(tasks.front(), top()))) {
+                auto t = tasks.front();
+                tasks.pop_front();
+                --numberOfQueuedTasks;
+                return t;
+            }
+            if (!empty()) {
+                auto t = top();
+                pop();
+                --numberOfQueuedTasks;
+                return t;
+            }
+        }
+
+        return stealTask(index);
+    }
+
+    //! Take the most important task from the front of the queues of the
+    //! other workers, so that an idle worker never starts a less critical
+    //! task while a critical one waits behind a busy worker
+    //! @return nullptr if all other queues is empty
+    IDependency *stealTask(size_t index) {
+        while (true) {
+            WorkerQueue *best = nullptr;
+            IDependency *bestTask = nullptr;
+            for (size_t i = 1; i < workerQueues.size(); ++i) {
+                auto &queue =
+                    *workerQueues.at((index + i) % workerQueues.size());
+                std::lock_guard<std::mutex> guard(queue.mutex);
+                if (!queue.tasks.empty() &&
+                    (!bestTask || comp(bestTask, queue.tasks.front()))) {
+                    best = &queue;
+                    bestTask = queue.tasks.front();
+                }
+            }
+
+            if (!best) {
+                return nullptr;
+            }
+
+            std::lock_guard<std::mutex> guard(best->mutex);
+            if (!best->tasks.empty() && best->tasks.front() == bestTask) {
+                best->tasks.pop_front();
+                --numberOfQueuedTasks;
+                return bestTask;
+            }
+            // The owner took the task while the queues was compared
+        }
+    }
+
+    //! Add a task to the queue of a worker. The queue is ordered by
+    //! critical path, with the most important task first
+    void pushLocal(WorkerQueue &queue, IDependency *t) {
+        auto &tasks = queue.tasks;
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        tasks.insert(
+            std::lower_bound(tasks.begin(),
+                             tasks.end(),
+                             t,
+                             [this](auto a, auto b) { return comp(b, a); }),
+            t);
+        ++numberOfQueuedTasks;
+    }
+
+    //! Return tasks that was taken but could not be started, and wait until
+    //! a running job is finished or new tasks is added, since that is what
+    //! can make it possible to start them
+    //! @param finishedJobs numberOfFinishedJobs when the first task was
+    //! refused
+    void waitForAdmission(size_t index,
+                          std::vector<IDependency *> &refused,
+                          size_t finishedJobs) {
+        for (auto t : refused) {
+            pushLocal(*workerQueues.at(index), t);
+        }
+        refused.clear();
+
+        std::unique_lock<std::mutex> lock(workAssignMutex);
+        size_t queuedTasks = numberOfQueuedTasks;
+        auto canContinue = [&] {
+            return numberOfFinishedJobs != finishedJobs ||
+                   numberOfQueuedTasks > queuedTasks || isFinished();
+        };
+        ++numberOfSleepingWorkers;
+        if (admission.isLimitedBySystem()) {
+            // There is no event for when the load or free memory changes
+            workCondition.wait_for(
+                lock, std::chrono::milliseconds(50), canContinue);
+        }
+        else {
+            workCondition.wait(lock, canContinue);
+        }
+        --numberOfSleepingWorkers;
+    }
+
+    //! Limit the number of jobs that can run in a job pool at the same time
+    void poolSize(const std::string &pool, size_t size) {
+        admission.poolSize(pool, size);
+    }
+
     // This is what a single thread will do
-    void workThreadFunction(int i, const IFiles &files) {
+    void workThreadFunction(size_t index, const IFiles &files) {
         using namespace std;
 
-        dout << "starting thread " << endl;
+        dout << "starting thread " << index + 1 << endl;
 
-        workAssignMutex.lock();
-        while (!empty()) {
+        currentWorker = {this, workerQueues.at(index).get()};
 
-            auto t = front();
-            pop();
-            workAssignMutex.unlock();
-            try {
-                auto buildRule = t->parentRule();
-                auto output = buildRule->work(files, *this);
-                stringstream ss;
-                ss << "[" << getBuildProgress() << "%] ";
-                if (globals.verbose && !output.empty()) {
-                    ss << output;
+        // Tasks that could not be started, kept until all tasks is tried
+        std::vector<IDependency *> refused;
+        size_t finishedJobsAtRefusal = 0;
+
+        while (!globals.bailout) {
+            auto t = takeTask(index);
+
+            if (!t && !refused.empty()) {
+                waitForAdmission(index, refused, finishedJobsAtRefusal);
+                continue;
+            }
+
+            if (!t) {
+                if (isFinished()) {
+                    wakeWorkers(true);
+                    break;
                 }
 
-                vout << ss.str();
-                ++this->taskFinished;
+                // Sleep until there is work, or until no running task can
+                // produce any more work
+                unique_lock<mutex> lock(workAssignMutex);
+                ++numberOfSleepingWorkers;
+                workCondition.wait(lock, [this] {
+                    return numberOfQueuedTasks > 0 || isFinished();
+                });
+                --numberOfSleepingWorkers;
+                continue;
+            }
+
+            auto memory = expectedMemory(t, files);
+            auto pool = t->parentRule()->poolName();
+            if (!admission.tryStart(memory, pool)) {
+                // Try other tasks that may be in another pool
+                if (refused.empty()) {
+                    finishedJobsAtRefusal = numberOfFinishedJobs;
+                }
+                refused.push_back(t);
+                continue;
+            }
+            for (auto r : refused) {
+                pushLocal(*workerQueues.at(index), r);
+            }
+            refused.clear();
+
+            status.jobStarted(
+                t, t->output(), expectedDuration(t, files.buildLog()));
+            try {
+                auto output = runTask(t, files);
+                status.jobFinished(t);
+                printTaskOutput(output);
             }
             catch (MatmakeError &e) {
-                cerr << e.what() << endl;
-                globals.bailout = true;
+                status.jobFinished(t);
+                taskFailed(t, e);
             }
-            printProgress();
+            admission.finish(memory, pool);
+            ++numberOfFinishedJobs;
 
-            workAssignMutex.lock();
+            --numberOfUnfinishedTasks;
+            wakeWorkers(true); // Workers may wait for the job to finish
         }
-        workAssignMutex.unlock();
 
-        workMutex.try_lock();
-        workMutex.unlock();
+        currentWorker = {nullptr, nullptr};
 
-        dout << "thread " << i << " is finished quit" << endl;
-        numberOfActiveThreads -= 1;
+        dout << "thread " << index + 1 << " is finished quit" << endl;
     }
 
     void workMultiThreaded(const IFiles &fileHandler) {
@@ -85,72 +440,144 @@ public:
         vout << "running with " << globals.numberOfThreads << " threads"
              << endl;
 
-        std::vector<std::thread> threads;
-        numberOfActiveThreads = 0;
+        auto numberOfWorkers = globals.numberOfThreads;
+        if (maxTasks > 0) {
+            numberOfWorkers =
+                min(numberOfWorkers, static_cast<size_t>(maxTasks));
+        }
+
+        status.start(static_cast<size_t>(maxTasks), totalWork, numberOfWorkers);
 
-        auto f = [this, &fileHandler](int i) {
+        workerQueues.clear();
+        for (size_t i = 0; i < numberOfWorkers; ++i) {
+            workerQueues.push_back(make_unique<WorkerQueue>());
+        }
+
+        runOnWorkers(numberOfWorkers, [this, &fileHandler](size_t i) {
             workThreadFunction(i, fileHandler);
-        };
+        });
+        workerQueues.clear();
+    }
 
-        threads.reserve(globals.numberOfThreads);
-        auto startTaskNum = size();
-        for (size_t i = 0; i < globals.numberOfThreads && i < startTaskNum;
-             ++i) {
-            ++numberOfActiveThreads;
-            threads.emplace_back(f, static_cast<int>(numberOfActiveThreads));
+    //! The memory in MB that a task is guessed to use, based on the last
+    //! time it was built
+    long expectedMemory(IDependency *t, const IFiles &files) const {
+        if (!globals.memoryBudget) {
+            return 0;
+        }
+        auto &log = files.buildLog();
+        if (auto memory = log.peakMemory(t->output())) {
+            return memory;
         }
+        return log.averagePeakMemory();
+    }
 
-        for (auto &t : threads) {
-            t.detach();
+    //! The time in milliseconds that a task is guessed to take, based on the
+    //! last time it was built
+    long expectedDuration(const IDependency *t, const BuildLog &log) const {
+        if (auto duration = log.duration(t->output())) {
+            return duration;
         }
+        return defaultDuration;
+    }
 
-        while (numberOfActiveThreads > 0 && !globals.bailout) {
-            workMutex.lock();
-            dout << "remaining tasks " << size() << " tasks" << endl;
-            dout << "number of active threads at this point "
-                 << numberOfActiveThreads << endl;
-            if (!empty()) {
-                std::lock_guard<mutex> guard(workAssignMutex);
-                auto numTasks = size();
-                if (numTasks > numberOfActiveThreads) {
-                    for (auto i = numberOfActiveThreads.load();
-                         i < globals.numberOfThreads && i < numTasks;
-                         ++i) {
-                        dout << "Creating new worker thread to manage tasks"
-                             << endl;
-                        ++numberOfActiveThreads;
-                        thread t(f, static_cast<int>(numberOfActiveThreads));
-                        t.detach(); // Make the thread live without owning it
-                    }
+    //! Run the work of a single task and save the time it took to the build
+    //! log so that it can be used to schedule the next build
+    std::string runTask(IDependency *t, const IFiles &files) {
+        using namespace std::chrono;
+        auto startTime = steady_clock::now();
+
+        if (t->skipIfUnchanged(files, *this)) {
+            return {};
+        }
+
+        auto output = t->parentRule()->work(files, *this);
+
+        auto duration =
+            duration_cast<milliseconds>(steady_clock::now() - startTime);
+        auto &name = t->output();
+        if (!name.empty()) {
+            // Zero is reserved for unknown durations
+            files.buildLog().duration(
+                name, std::max(1L, static_cast<long>(duration.count())));
+        }
+
+        return output;
+    }
+
+    //! Calculate the longest estimated path from each dirty file to the end
+    //! of the build, using the durations from the previous builds
+    void calculateCriticalPaths(const BuildRuleList &files,
+                                const BuildLog &log) {
+        auto &criticalPath = comp.criticalPath;
+        criticalPath.clear();
+
+        // Files that has never been built is guessed to be average
+        defaultDuration = std::max(1L, log.averageDuration());
+        totalWork = 0;
+
+        std::function<long(IDependency *)> calculate =
+            [&](IDependency *d) -> long {
+            auto f = criticalPath.find(d);
+            if (f != criticalPath.end()) {
+                return f->second;
+            }
+            criticalPath[d] = 0; // Protect against circular dependencies
+
+            long longestSubscriber = 0;
+            for (auto s : d->subscribers()) {
+                if (s->dirty()) {
+                    longestSubscriber =
+                        std::max(longestSubscriber, calculate(s));
                 }
             }
+
+            auto duration = expectedDuration(d, log);
+            totalWork += duration;
+            return criticalPath[d] = duration + longestSubscriber;
+        };
+
+        for (auto &file : files) {
+            if (file->dependency().dirty()) {
+                calculate(&file->dependency());
+            }
         }
+
+        // Tasks may have been added before the paths was known
+        std::make_heap(c.begin(), c.end(), comp);
     }
 
     void work(BuildRuleList files, const IFiles &fileHandler) {
         using namespace std;
+        calculateCriticalPaths(files, fileHandler.buildLog());
+
         if (globals.numberOfThreads > 1) {
             workMultiThreaded(fileHandler);
         }
         else {
             globals.numberOfThreads = 1;
             vout << "running with 1 thread" << endl;
-            while (!empty()) {
-                auto t = front();
+            status.start(static_cast<size_t>(maxTasks), totalWork, 1);
+            while (!empty() && !globals.bailout) {
+                auto t = top();
                 pop();
+                --numberOfQueuedTasks;
+                status.jobStarted(
+                    t,
+                    t->output(),
+                    expectedDuration(t, fileHandler.buildLog()));
                 try {
-                    auto output = t->parentRule()->work(fileHandler, *this);
-                    if (globals.verbose && !output.empty()) {
-                        std::cout << output;
-                        std::cout.flush();
-                    }
+                    auto output = runTask(t, fileHandler);
+                    status.jobFinished(t);
+                    printTaskOutput(output);
                 }
                 catch (MatmakeError &e) {
-                    dout << e.what() << endl;
-                    globals.bailout = true;
+                    status.jobFinished(t);
+                    taskFailed(t, e);
                 }
             }
         }
+        status.stop();
 
         for (auto &file : files) {
             if (file->dependency().dirty()) {
@@ -163,55 +590,75 @@ public:
             }
         }
 
+        printFailures(files);
+
         if (globals.verbose) {
             vout << "[100%] ";
         }
         vout << "finished" << endl;
     }
 
-    int getBuildProgress() const {
-        if (maxTasks) {
-            return (taskFinished * 100 / maxTasks);
+    //! Remember a task that could not be built. Tasks depending on it is
+    //! never started since they are never notified, but other tasks
+    //! continues until globals.maxFailures tasks has failed. Then the
+    //! commands that is still running is stopped
+    void taskFailed(IDependency *t, const MatmakeError &e) {
+        std::lock_guard<std::mutex> guard(failedMutex);
+        if (globals.bailout) {
+            // The task was probably stopped because of the bailout, only the
+            // errors that caused the bailout is interesting
+            failedTasks.push_back(t);
+            return;
         }
-        else {
-            return 100;
+        status.print(std::string(e.what()) + "\n", true);
+        failedTasks.push_back(t);
+        if (globals.maxFailures && failedTasks.size() >= globals.maxFailures) {
+            globals.bailout = true;
+            killRunningProcesses();
         }
     }
 
-    void printProgress() {
-        if (!maxTasks) {
+    //! Print which files failed and which files could not be built because
+    //! of the failures, and mark the build as failed
+    void printFailures(const BuildRuleList &files) {
+        if (failedTasks.empty()) {
             return;
         }
-        int amount = getBuildProgress();
+        globals.bailout = true;
 
-        if (amount == lastProgress) {
-            return;
+        if (globals.maxFailures == 1) {
+            return; // Only one failure is expected, that is already printed
         }
-        lastProgress = amount;
 
-        std::stringstream ss;
-
-        if (!globals.debugOutput && !globals.verbose) {
-            ss << "[";
-            for (int i = 0; i < amount / 4; ++i) {
-                ss << "-";
-            }
-            if (amount < 100) {
-                ss << ">";
-            }
-            else {
-                ss << "-";
-            }
-            for (int i = amount / 4; i < 100 / 4; ++i) {
-                ss << " ";
+        std::vector<std::string> skipped;
+        for (auto &file : files) {
+            auto &dependency = file->dependency();
+            if (dependency.dirty() &&
+                std::find(failedTasks.begin(),
+                          failedTasks.end(),
+                          &dependency) == failedTasks.end()) {
+                skipped.push_back(dependency.output());
             }
-            ss << "] " << amount << "%  \r";
         }
-        else {
-            // ss << "[" << amount << "%] ";
+
+        std::cerr << "\n"
+                  << failedTasks.size() << " files failed and "
+                  << skipped.size() << " files was skipped\n";
+        for (auto t : failedTasks) {
+            std::cerr << "failed:  " << t->output() << "\n";
+        }
+        for (auto &output : skipped) {
+            std::cerr << "skipped: " << output << "\n";
         }
+    }
 
-        std::cout << ss.str();
-        std::cout.flush();
+    //! Print the output of a finished task in verbose mode
+    void printTaskOutput(const std::string &output) {
+        // Skipped tasks has no output
+        if (globals.verbose && !output.empty()) {
+            std::ostringstream ss;
+            ss << "[" << status.progress() << "%] " << output;
+            status.print(ss.str());
+        }
     }
 };
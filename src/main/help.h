@@ -18,6 +18,21 @@ test              run all tests
 --list -l         print a list of available targets
 -j [n]            use [n] number of threads
 -j 1              run in single thread mode
+--load-average [load]
+                  do not start new jobs when the load average is above [load]
+--min-memory [n]  do not start new jobs when less than [n] MB memory is free
+--memory-budget [n]
+                  limit running jobs to use [n] MB memory together, based on
+                  how much memory each job used the last build
+-k [n]            keep building files that does not depend on failed files,
+                  stop after [n] failures if specified
+--content-hash    do not rebuild files when the content of the source files
+                  and headers are the same as last build, even if they are
+                  touched. Files is not relinked when the rebuilt object
+                  files are the same as last build
+--scan-deps       let clang-scan-deps find the c++20 modules that files
+                  depend on, instead of matmakes own scanner
+--scan-deps=[cmd] the same, with another clang-scan-deps command
 --help or -h      print this text
 --init            create a cpp project in current directory
 --init [dir]      create a cpp project in the specified directory
@@ -7,6 +7,8 @@
 #include "environment/environment.h"
 #include "environment/files.h"
 #include "environment/globals.h" // Global variables
+#include "environment/jobserver.h"
+#include "environment/process.h"
 #include "environment/locals.h"
 #include "help.h"
 #include "main/token.h"
@@ -69,6 +71,9 @@ int start(std::vector<std::string> args) {
         }
     }
 
+    jobServer.init(globals.numberOfThreads);
+    installInterruptHandler();
+
     auto files = std::make_shared<Files>();
     Environment environment(files);
 
@@ -4,6 +4,8 @@
 #include "environment/locals.h"
 #include "main/createproject.h"
 #include "main/help.h"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
 IsErrorT tokenizeMatmakeFile() {
@@ -28,6 +30,22 @@ IsErrorT tokenizeMatmakeFile() {
     return false;
 }
 
+//! Check if a argument only contains digits (and possibly a decimal point)
+inline bool isNumber(const std::string &str) {
+    return !str.empty() &&
+           std::all_of(str.begin(), str.end(), [](char c) {
+               return isdigit(c) || c == '.';
+           });
+}
+
+//! Check if a argument only contains digits
+inline bool isInteger(const std::string &str) {
+    return !str.empty() &&
+           std::all_of(str.begin(), str.end(), [](char c) {
+               return isdigit(c);
+           });
+}
+
 //! Parse arguments and produce a new Locals object containing the result
 //!
 //! Also alters globals object if any options related to that is used
@@ -54,6 +72,69 @@ std::tuple<ShouldQuitT, IsErrorT> parseArguments(std::vector<std::string> args,
         else if (arg == "-v" || arg == "--verbose") {
             globals.verbose = true;
         }
+        else if (arg == "--load-average") {
+            // Not -l as in make, since -l is used for --list
+            ++i;
+            if (i < args.size() && isNumber(args[i])) {
+                globals.maxLoad = atof(args[i].c_str());
+            }
+            else {
+                cerr << "expected load after --load-average argument" << endl;
+                isError = true;
+                break;
+            }
+        }
+        else if (arg == "--min-memory") {
+            ++i;
+            if (i < args.size() && isInteger(args[i])) {
+                globals.minFreeMemory = strtoul(args[i].c_str(), nullptr, 10);
+            }
+            else {
+                cerr << "expected a whole number of MB after --min-memory "
+                        "argument"
+                     << endl;
+                isError = true;
+                break;
+            }
+        }
+        else if (arg == "--memory-budget") {
+            ++i;
+            if (i < args.size() && isInteger(args[i])) {
+                globals.memoryBudget = strtoul(args[i].c_str(), nullptr, 10);
+            }
+            else {
+                cerr << "expected a whole number of MB after --memory-budget "
+                        "argument"
+                     << endl;
+                isError = true;
+                break;
+            }
+        }
+        else if (arg == "-k" || arg == "--keep-going") {
+            // Without a number the build continues after any number of
+            // failures
+            globals.maxFailures = 0;
+            if (i + 1 < args.size() && isNumber(args[i + 1])) {
+                ++i;
+                if (!isInteger(args[i])) {
+                    cerr << "expected a whole number of failures after -k "
+                            "argument"
+                         << endl;
+                    isError = true;
+                    break;
+                }
+                globals.maxFailures = strtoul(args[i].c_str(), nullptr, 10);
+            }
+        }
+        else if (arg == "--content-hash") {
+            globals.contentHash = true;
+        }
+        else if (arg == "--scan-deps") {
+            globals.scanDeps = "clang-scan-deps";
+        }
+        else if (arg.rfind("--scan-deps=", 0) == 0) {
+            globals.scanDeps = arg.substr(arg.find('=') + 1);
+        }
         else if (arg == "--list" || arg == "-l") {
             locals.operation = "list";
         }
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "environment/globals.h"
 #include "environment/ienvironment.h"
 #include "environment/ifiles.h"
+#include "environment/jobserver.h"
 #include "environment/locals.h"
 #include "main/mdebug.h"
 #include "matmake-common.h"
@@ -37,7 +39,10 @@ std::tuple<ShouldQuitT, IsErrorT, TargetPropertyCollection> parseMatmakeFile(
             for (auto arg : locals.args) {
                 arguments += (" " + arg);
             }
-            arguments += " -j";
+            if (!jobServer.isActive()) {
+                // Otherwise make finds the jobserver in MAKEFLAGS
+                arguments += " -j" + std::to_string(globals.numberOfThreads);
+            }
             files.system(arguments.c_str());
             std::cout << "\n";
         }
@@ -0,0 +1,120 @@
+//! Copyright Mattias Larsson Sköld 2020
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+//! A path that is only stored once in the program
+//!
+//! Paths like headers and build directories is used by thousands of files.
+//! All PathIds with the same path refers to the same string, so copying and
+//! comparing them is as fast as for a pointer. Paths is never removed
+class PathId {
+public:
+    //! A empty path
+    PathId() = default;
+
+    //! Find or add the path
+    explicit PathId(std::string_view path) : _entry(table().find(path)) {}
+
+    const std::string &str() const {
+        return _entry ? _entry->path : emptyEntry().path;
+    }
+
+    //! A small number unique for each path, 0 for the empty path
+    uint32_t id() const {
+        return _entry ? _entry->id : 0;
+    }
+
+    bool empty() const {
+        return !_entry;
+    }
+
+    bool operator==(PathId other) const {
+        return _entry == other._entry;
+    }
+
+    bool operator!=(PathId other) const {
+        return _entry != other._entry;
+    }
+
+    //! Paths is ordered by when they was added, not alphabetically
+    bool operator<(PathId other) const {
+        return id() < other.id();
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, PathId path) {
+        return stream << path.str();
+    }
+
+private:
+    struct Entry {
+        std::string path;
+        uint32_t id = 0;
+    };
+
+    //! Thread safe, since files is scanned and prepared in parallel
+    class Table {
+    public:
+        const Entry *find(std::string_view path) {
+            if (path.empty()) {
+                return nullptr;
+            }
+            {
+                std::shared_lock<std::shared_mutex> lock(_mutex);
+                auto f = _index.find(path);
+                if (f != _index.end()) {
+                    return f->second;
+                }
+            }
+
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            auto f = _index.find(path);
+            if (f != _index.end()) {
+                return f->second; // Added by another thread
+            }
+            // References to elements in a deque is kept when it grows
+            _entries.push_back(
+                {std::string{path}, static_cast<uint32_t>(_entries.size() + 1)});
+            auto entry = &_entries.back();
+            _index[entry->path] = entry;
+            return entry;
+        }
+
+    private:
+        std::shared_mutex _mutex;
+        std::deque<Entry> _entries;
+        std::unordered_map<std::string_view, const Entry *> _index;
+    };
+
+    static Table &table() {
+        static Table table;
+        return table;
+    }
+
+    static const Entry &emptyEntry() {
+        static const Entry entry;
+        return entry;
+    }
+
+    const Entry *_entry = nullptr;
+};
+
+namespace std {
+
+template <>
+struct hash<PathId> {
+    size_t operator()(PathId path) const {
+        return path.id();
+    }
+};
+
+} // namespace std
@@ -0,0 +1,141 @@
+
+#include "environment/admission.h"
+#include "mls-unit-test/unittest.h"
+
+namespace {
+
+class FakeAdmissionControl : public AdmissionControl {
+public:
+    double load = 0;
+    long memory = -1;
+    int tokens = 1000;
+
+    double loadAverage() override {
+        return load;
+    }
+
+    long availableMemory() override {
+        return memory;
+    }
+
+    bool tryAcquireToken() override {
+        if (tokens > 0) {
+            --tokens;
+            return true;
+        }
+        return false;
+    }
+
+    void releaseToken() override {
+        ++tokens;
+    }
+};
+
+struct RestoreGlobals {
+    ~RestoreGlobals() {
+        globals.maxLoad = 0;
+        globals.minFreeMemory = 0;
+        globals.memoryBudget = 0;
+    }
+};
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("no limits") {
+    FakeAdmissionControl admission;
+    admission.load = 100;
+
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(admission.tryStart(), true);
+    }
+    ASSERT_EQ(admission.running(), 10);
+}
+
+TEST_CASE("load limit") {
+    RestoreGlobals restore;
+    FakeAdmissionControl admission;
+    globals.maxLoad = 4;
+
+    // Other processes uses two cores
+    admission.load = 2;
+
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tryStart(), false);
+    ASSERT_EQ(admission.isLimitedBySystem(), true);
+
+    admission.finish();
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.isLimitedBySystem(), false);
+}
+
+TEST_CASE("always start first job") {
+    RestoreGlobals restore;
+    FakeAdmissionControl admission;
+    globals.maxLoad = 1;
+    admission.load = 40;
+
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tryStart(), false);
+}
+
+TEST_CASE("memory limit") {
+    RestoreGlobals restore;
+    FakeAdmissionControl admission;
+    globals.minFreeMemory = 1000;
+    admission.memory = 500;
+
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tryStart(), false);
+}
+
+TEST_CASE("memory budget") {
+    RestoreGlobals restore;
+    FakeAdmissionControl admission;
+    globals.memoryBudget = 1000;
+
+    ASSERT_EQ(admission.tryStart(600), true);
+    ASSERT_EQ(admission.tryStart(600), false);
+    // Only finished jobs can make room in the budget
+    ASSERT_EQ(admission.isLimitedBySystem(), false);
+    ASSERT_EQ(admission.tryStart(300), true);
+
+    admission.finish(600);
+    ASSERT_EQ(admission.tryStart(600), true);
+}
+
+TEST_CASE("job pools") {
+    FakeAdmissionControl admission;
+    admission.poolSize("link", 1);
+
+    ASSERT_EQ(admission.tryStart(0, "link"), true);
+    ASSERT_EQ(admission.tryStart(0, "link"), false);
+    ASSERT_EQ(admission.isLimitedBySystem(), false);
+
+    // Other pools and jobs without pools is not limited
+    ASSERT_EQ(admission.tryStart(0, "compile"), true);
+    ASSERT_EQ(admission.tryStart(), true);
+
+    admission.finish(0, "link");
+    ASSERT_EQ(admission.tryStart(0, "link"), true);
+}
+
+TEST_CASE("jobserver tokens") {
+    FakeAdmissionControl admission;
+    admission.tokens = 1;
+
+    // The first job does not need a token
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tryStart(), true);
+    ASSERT_EQ(admission.tokens, 0);
+    ASSERT_EQ(admission.tryStart(), false);
+
+    admission.finish();
+    ASSERT_EQ(admission.tokens, 1);
+    admission.finish();
+    ASSERT_EQ(admission.tokens, 1);
+}
+
+TEST_SUIT_END
@@ -0,0 +1,208 @@
+#include "environment/builddatabase.h"
+#include "mls-unit-test/unittest.h"
+
+namespace {
+
+const std::string path = "builddatabase_test_db";
+const std::string hashedPath = "builddatabase_test_file";
+
+size_t fileSize() {
+    return static_cast<size_t>(
+        std::ifstream(path, std::ios::binary | std::ios::ate).tellg());
+}
+
+BuildDatabase::Entry entry(std::vector<std::string> dependencies,
+                          std::string command) {
+    BuildDatabase::Entry entry{{}, command};
+    for (auto &dependency : dependencies) {
+        entry.dependencies.emplace_back(dependency);
+    }
+    return entry;
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("entries is saved and loaded") {
+    std::remove(path.c_str());
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.set("a.o.d", entry({"a.cpp", "a.h"}, "c++ -c a.cpp"));
+        database.set("b.o.d", entry({"b.cpp"}, "c++ -c b.cpp"));
+        database.save();
+    }
+
+    BuildDatabase database;
+    database.load(path);
+    auto a = database.get("a.o.d");
+    ASSERT_EQ(a->dependencies.size(), 2);
+    ASSERT_EQ(a->dependencies.at(1), PathId{"a.h"});
+    ASSERT_EQ(a->command, "c++ -c a.cpp");
+    ASSERT_EQ(database.get("b.o.d")->command, "c++ -c b.cpp");
+    ASSERT(database.get("c.o.d")->command.empty(), "unknown entry");
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("changed entries is appended") {
+    std::remove(path.c_str());
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.set("a.o.d", entry({"a.cpp"}, "c++ -c a.cpp"));
+        database.set("b.o.d", entry({"b.cpp"}, "c++ -c b.cpp"));
+        database.save();
+    }
+    auto sizeBefore = fileSize();
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.set("a.o.d", entry({"a.cpp"}, "c++ -c a.cpp")); // Not changed
+        database.save();
+        ASSERT_EQ(fileSize(), sizeBefore);
+
+        database.set("a.o.d", entry({"a.cpp"}, "c++ -O2 -c a.cpp"));
+        database.save();
+        ASSERT_GT(fileSize(), sizeBefore);
+    }
+
+    BuildDatabase database;
+    database.load(path);
+    ASSERT_EQ(database.get("a.o.d")->command, "c++ -O2 -c a.cpp");
+    ASSERT_EQ(database.get("b.o.d")->command, "c++ -c b.cpp");
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("cut off file is read until the damaged entry") {
+    std::remove(path.c_str());
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.set("a.o.d", entry({"a.cpp"}, "c++ -c a.cpp"));
+        database.save();
+        database.set("b.o.d", entry({"b.cpp"}, "c++ -c b.cpp"));
+        database.save();
+    }
+
+    // Remove the last bytes, as if matmake was killed while saving
+    std::string content;
+    {
+        std::ifstream file(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+    }
+    std::ofstream(path, std::ios::binary)
+        .write(content.data(),
+               static_cast<std::streamsize>(content.size() - 3));
+
+    {
+        BuildDatabase database;
+        database.load(path);
+        ASSERT_EQ(database.get("a.o.d")->command, "c++ -c a.cpp");
+        ASSERT(database.get("b.o.d")->command.empty(), "damaged entry");
+
+        database.set("c.o.d", entry({"c.cpp"}, "c++ -c c.cpp"));
+        database.save();
+    }
+
+    BuildDatabase database;
+    database.load(path);
+    ASSERT_EQ(database.get("a.o.d")->command, "c++ -c a.cpp");
+    ASSERT_EQ(database.get("c.o.d")->command, "c++ -c c.cpp");
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("build log is saved in the database") {
+    std::remove(path.c_str());
+    std::ofstream(hashedPath) << "int x;";
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.log().duration("a.o", 100);
+        database.log().signature("a.o", 1234);
+        database.log().outputHash("a.o", 5678);
+        database.log().fileHash(hashedPath, {10, 20, 30, 40});
+        database.save();
+    }
+
+    {
+        BuildDatabase database;
+        database.load(path);
+        auto &log = database.log();
+        ASSERT_EQ(log.duration("a.o"), 100);
+        ASSERT_EQ(log.signature("a.o"), 1234);
+        ASSERT_EQ(log.outputHash("a.o"), 5678);
+        ASSERT_EQ(log.signature("b.o"), 0);
+        ASSERT(log.fileHash(hashedPath), "file hash was not saved");
+        ASSERT_EQ(log.fileHash(hashedPath)->hash, 40);
+        ASSERT(!log.fileHash("b.cpp"), "unknown file should have no hash");
+
+        // Only the changed entry is appended
+        auto sizeBefore = fileSize();
+        log.duration("a.o", 200);
+        database.save();
+        ASSERT_GT(fileSize(), sizeBefore);
+    }
+
+    BuildDatabase database;
+    database.load(path);
+    ASSERT_EQ(database.log().duration("a.o"), 200);
+    ASSERT_EQ(database.log().signature("a.o"), 1234);
+
+    std::remove(path.c_str());
+    std::remove(hashedPath.c_str());
+}
+
+TEST_CASE("hashes of removed files is not saved when the file is rewritten") {
+    std::remove(path.c_str());
+    std::ofstream(hashedPath) << "int x;";
+    {
+        BuildDatabase database;
+        database.load(path);
+        database.log().fileHash(hashedPath, {10, 20, 30, 40});
+        database.log().fileHash("builddatabase_test_removed", {1, 2, 3, 4});
+        database.save();
+    }
+
+    BuildDatabase database;
+    database.load(path);
+    ASSERT(database.log().fileHash(hashedPath),
+           "existing file should be kept");
+    ASSERT(!database.log().fileHash("builddatabase_test_removed"),
+           "removed file should be dropped");
+
+    std::remove(path.c_str());
+    std::remove(hashedPath.c_str());
+}
+
+TEST_CASE("old .d-files is read when not in the database") {
+    BuildDatabase database;
+    int numberOfReads = 0;
+    auto read = [&numberOfReads](const std::string &) {
+        ++numberOfReads;
+        return BuildDatabase::DepFileContent{{PathId{"a.cpp"}},
+                                             "c++ -c a.cpp"};
+    };
+
+    ASSERT_EQ(database.get("a.o.d", read)->command, "c++ -c a.cpp");
+    ASSERT_EQ(database.get("a.o.d", read)->command, "c++ -c a.cpp");
+    ASSERT_EQ(numberOfReads, 1);
+    ASSERT_EQ(database.get("a.o.d")->dependencies.at(0), PathId{"a.cpp"});
+}
+
+TEST_CASE("entries is shared until they is replaced") {
+    BuildDatabase database;
+    database.set("a.o.d", entry({"a.cpp"}, "c++ -c a.cpp"));
+    auto old = database.get("a.o.d");
+    ASSERT_EQ(database.get("a.o.d").get(), old.get());
+
+    database.set("a.o.d", entry({"a.cpp", "a.h"}, "c++ -c a.cpp"));
+    ASSERT_EQ(old->dependencies.size(), 1);
+    ASSERT_EQ(database.get("a.o.d")->dependencies.size(), 2);
+}
+
+TEST_SUIT_END
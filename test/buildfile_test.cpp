@@ -0,0 +1,151 @@
+#include "dependency/buildfile.h"
+#include "mls-unit-test/unittest.h"
+#include "mocks/mockibuildtarget.h"
+#include "mocks/mockifiles.h"
+#include "mocks/mockithreadpool.h"
+
+namespace {
+
+struct TestFixture {
+    TestFixture() {
+        target.mock_getBuildDirectory_0.returnValue("build/");
+        target.mock_getCompiler_1.returnValue("c++");
+        target.mock_getBuildFlags_1.returnValue("");
+        target.mock_preprocessCommand_1.onCall(
+            [](Token command) { return command; });
+        target.mock_hasModules_0.returnValue(false);
+
+        files.mock_buildDatabase_0.returnValueRef(database);
+        files.mock_buildLog_0.returnValueRef(log);
+        files.mock_popenWithResult_1.returnValue(PopenResult{0, ""});
+        files.mock_fileHash_1.returnValue(5);
+        files.mock_parseDepFile_1.returnValue(
+            MockIFiles::parseDepFileT{{PathId{"a.cpp"}}, ""});
+        // The source file is changed after the object file was built
+        files.mock_getTimeChanged_1.onCall([](const std::string &path) {
+            return (path == "build/a.cpp.o") ? 1 : 2;
+        });
+    }
+
+    MockIBuildTarget target;
+    MockIFiles files;
+    MockIThreadPool pool;
+    BuildLog log;
+    BuildDatabase database;
+    BuildRuleList rules;
+};
+
+//! Restores the setting when the test is finished
+struct ContentHash {
+    ContentHash() {
+        globals.contentHash = true;
+    }
+
+    ~ContentHash() {
+        globals.contentHash = oldValue;
+    }
+
+    bool oldValue = globals.contentHash;
+};
+
+bool contains(const std::vector<PathId> &paths, const std::string &path) {
+    return std::find(paths.begin(), paths.end(), PathId{path}) != paths.end();
+}
+
+bool contains(const std::string &str, const std::string &part) {
+    return str.find(part) != std::string::npos;
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("touched file with the same content is not built") {
+    ContentHash contentHash;
+    TestFixture f;
+    {
+        BuildFile file("a.cpp", &f.target, BuildFile::CppToO);
+        file.prepare(f.files, f.rules);
+        file.work(f.files, f.pool);
+    }
+
+    BuildFile file("a.cpp", &f.target, BuildFile::CppToO);
+    // The output is touched so that the next build does not hash the
+    // files again
+    f.files.mock_touch_1.expectArgs("build/a.cpp.o");
+    f.files.mock_touch_1.expectNum(1);
+    file.prepare(f.files, f.rules);
+
+    ASSERT(!file.dependency().dirty(), "same content should be fresh");
+}
+
+TEST_CASE("touched file with changed content is built") {
+    ContentHash contentHash;
+    TestFixture f;
+    {
+        BuildFile file("a.cpp", &f.target, BuildFile::CppToO);
+        file.prepare(f.files, f.rules);
+        file.work(f.files, f.pool);
+    }
+
+    f.files.mock_fileHash_1.returnValue(6);
+    BuildFile file("a.cpp", &f.target, BuildFile::CppToO);
+    f.files.mock_touch_1.expectNum(0);
+    file.prepare(f.files, f.rules);
+
+    ASSERT(file.dependency().dirty(), "changed content should be built");
+}
+
+TEST_CASE("includes missed by the scanner is taken from the compiler") {
+    TestFixture f;
+    f.target.mock_hasModules_0.returnValue(true);
+
+    // The include with a macro and the generated header can not be found
+    // by the scanner
+    std::map<std::string, std::string> content = {
+        {"a.cpp",
+         "#include CONFIG_HEADER\n#include \"generated.h\"\nimport b;\n"},
+        {"b.cppm", "export module b;\n"},
+    };
+    ScanCache cache;
+    std::istringstream ss;
+    f.files.mock_scanCache_0.returnValueRef(cache);
+    f.files.mock_getTimeChanged_1.onCall([&content](const std::string &path) {
+        return static_cast<FileTimeT>(content.count(path));
+    });
+    f.files.mock_openRead_1.onCall([&content, &ss](const std::string &path) {
+        ss.clear();
+        ss.str(content.at(path));
+        return fileFromSs(ss);
+    });
+
+    BuildRuleList rules;
+    rules.push_back(
+        std::make_unique<BuildFile>("a.cpp", &f.target, BuildFile::CppToO));
+    rules.push_back(
+        std::make_unique<BuildFile>("b.cppm", &f.target, BuildFile::CppToPcm));
+    auto &file = *rules.front();
+    for (auto &rule : rules) {
+        rule->prescan(f.files, rules);
+    }
+
+    auto scanned = f.database.get("build/a.cpp.o.d");
+    ASSERT(contains(scanned->dependencies, "build/b.pcm"), "");
+    ASSERT(!contains(scanned->dependencies, "generated.h"), "");
+
+    file.prepare(f.files, rules);
+    ASSERT(contains(file.dependency().command(), "-MMD"),
+           file.dependency().command());
+
+    f.files.mock_parseDepFile_1.returnValue(MockIFiles::parseDepFileT{
+        {PathId{"a.cpp"}, PathId{"config.h"}, PathId{"generated.h"}}, ""});
+    file.work(f.files, f.pool);
+
+    auto built = f.database.get("build/a.cpp.o.d");
+    ASSERT(contains(built->dependencies, "config.h"), "");
+    ASSERT(contains(built->dependencies, "generated.h"), "");
+    ASSERT(contains(built->dependencies, "build/b.pcm"), "");
+    ASSERT_EQ(built->command, file.dependency().command());
+}
+
+TEST_SUIT_END
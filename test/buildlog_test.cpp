@@ -0,0 +1,25 @@
+#include "environment/buildlog.h"
+#include "environment/files.h"
+#include "mls-unit-test/unittest.h"
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("file hash only depends on content") {
+    Files files;
+    auto path = std::string{"buildlog_test_file"};
+
+    files.replaceFile(path, "int x;");
+    auto hash = files.fileHash(path);
+    ASSERT_NE(hash, 0);
+
+    files.replaceFile(path, "int y;");
+    ASSERT_NE(files.fileHash(path), hash);
+
+    files.replaceFile(path, "int x;");
+    ASSERT_EQ(files.fileHash(path), hash);
+
+    std::remove(path.c_str());
+    ASSERT_EQ(files.fileHash(path), 0);
+}
+
+TEST_SUIT_END
@@ -0,0 +1,78 @@
+#include "environment/buildstatus.h"
+#include "mls-unit-test/unittest.h"
+#include "mocks/mockidependency.h"
+#include <sstream>
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("estimated time left") {
+    using namespace std::chrono;
+    BuildStatus status;
+    MockIDependency job1;
+    MockIDependency job2;
+
+    // Two jobs of one second and two of two seconds, on two threads
+    status.start(4, 6000, 2);
+    auto now = BuildStatus::Clock::now();
+    ASSERT_EQ(status.remainingTime(now), 3000);
+
+    status.jobStarted(&job1, "1.o", 1000);
+    status.jobStarted(&job2, "2.o", 2000);
+    auto later = BuildStatus::Clock::now() + milliseconds(500);
+    auto remaining = status.remainingTime(later);
+    // 3000 ms not started and 500 + 1500 ms left of the running jobs
+    ASSERT(remaining <= 2500 && remaining > 2400, remaining);
+
+    // Jobs that takes longer than expected has nothing left
+    auto muchLater = BuildStatus::Clock::now() + milliseconds(5000);
+    ASSERT_EQ(status.remainingTime(muchLater), 1500);
+
+    status.jobFinished(&job1);
+    ASSERT_EQ(status.remainingTime(muchLater), 1500);
+    status.stop();
+}
+
+TEST_CASE("output is printed a line at a time while running") {
+    std::ostringstream out;
+    auto oldBuffer = std::cout.rdbuf(out.rdbuf());
+
+    {
+        BuildStatus status;
+        status.start(1, 0, 1);
+        std::thread thread([] { std::cout << "from another thread\n"; });
+        std::cout << "first ";
+        thread.join();
+        std::cout << "line\n";
+        std::cout << "unfinished";
+        status.stop();
+
+        ASSERT_EQ(std::cout.rdbuf(), out.rdbuf());
+    }
+
+    std::cout.rdbuf(oldBuffer);
+
+    ASSERT_EQ(out.str(), "from another thread\nfirst line\nunfinished");
+}
+
+TEST_CASE("progress is printed a line at a time without a terminal") {
+    std::ostringstream out;
+    auto oldBuffer = std::cout.rdbuf(out.rdbuf());
+    MockIDependency job1;
+    MockIDependency job2;
+
+    {
+        BuildStatus status;
+        status.start(2, 0, 1, false);
+        status.jobStarted(&job1, "1.o", 0);
+        status.jobFinished(&job1);
+        status.jobStarted(&job2, "2.o", 0);
+        status.jobFinished(&job2);
+        status.stop();
+    }
+
+    std::cout.rdbuf(oldBuffer);
+
+    ASSERT_EQ(out.str(), "[1/2] 1.o\n[2/2] 2.o\n");
+}
+
+TEST_SUIT_END
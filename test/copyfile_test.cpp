@@ -29,7 +29,7 @@ TEST_CASE("instantiate") {
 
     dep->mock_output_1.expectArgs("bin/a.txt");
     dep->mock_input_1.expectArgs("a.txt");
-    dep->mock_output_0.returnValue("a.txt");
+    dep->mock_output_0.returnValueRef(PathId{"a.txt"}.str());
     f.target.mock_getOutputDir_0.returnValue("bin");
 
     CopyFile copyFile("a.txt", &f.target, std::move(dep));
@@ -40,9 +40,9 @@ TEST_CASE("prepare") {
     auto dep = createDependencyMock();
 
     dep->mock_input_1.nice();
-    dep->mock_input_0.returnValue("a.txt");
+    dep->mock_input_0.returnValueRef(PathId{"a.txt"}.str());
     dep->mock_output_1.nice();
-    dep->mock_output_0.returnValue("bin/a.txt");
+    dep->mock_output_0.returnValueRef(PathId{"bin/a.txt"}.str());
 
     dep->mock_inputChangedTime_1.returnValue(10);
     dep->mock_changedTime_1.returnValue(7);
@@ -61,9 +61,9 @@ TEST_CASE("prepare (fresh)") {
     auto dep = createDependencyMock();
 
     dep->mock_input_1.nice();
-    dep->mock_input_0.returnValue("a.txt");
+    dep->mock_input_0.returnValueRef(PathId{"a.txt"}.str());
     dep->mock_output_1.nice();
-    dep->mock_output_0.returnValue("bin/a.txt");
+    dep->mock_output_0.returnValueRef(PathId{"bin/a.txt"}.str());
 
     dep->mock_inputChangedTime_1.returnValue(7);
     dep->mock_changedTime_1.returnValue(10);
@@ -82,9 +82,9 @@ TEST_CASE("copy") {
     auto dep = createDependencyMock();
 
     dep->mock_input_1.nice();
-    dep->mock_input_0.returnValue("a.txt");
+    dep->mock_input_0.returnValueRef(PathId{"a.txt"}.str());
     dep->mock_output_1.nice();
-    dep->mock_output_0.returnValue("bin/a.txt");
+    dep->mock_output_0.returnValueRef(PathId{"bin/a.txt"}.str());
 
     dep->mock_inputChangedTime_1.returnValue(10);
     dep->mock_changedTime_1.returnValue(7);
@@ -102,9 +102,38 @@ TEST_CASE("copy") {
     rawDep->mock_dirty_1.expectArgs(false);
 
     f.files.mock_copyFile_2.expectArgs("a.txt", "bin/a.txt");
-    rawDep->mock_sendSubscribersNotice_1.expectMinNum(1);
+    rawDep->mock_sendSubscribersNotice_2.expectMinNum(1);
 
     copyFile.work(f.files, f.pool);
 }
 
+TEST_CASE("copy failure is printed by the thread pool") {
+    TestFixture f;
+    auto dep = createDependencyMock();
+
+    dep->mock_input_1.nice();
+    dep->mock_input_0.returnValueRef(PathId{"a.txt"}.str());
+    dep->mock_output_1.nice();
+    dep->mock_output_0.returnValueRef(PathId{"bin/a.txt"}.str());
+    dep->mock_target_0.returnValue(&f.target);
+
+    f.target.mock_getOutputDir_0.returnValue("bin");
+    f.target.mock_name_0.returnValue("a");
+
+    CopyFile copyFile("a.txt", &f.target, std::move(dep));
+
+    f.files.mock_copyFile_2.onCall([](auto &&, auto &&) {
+        throw std::runtime_error("no space left");
+    });
+
+    bool isError = false;
+    f.pool.mock_print_2.onCall(
+        [&isError](auto &&, bool error) { isError = error; });
+    f.pool.mock_print_2.expectNum(1);
+
+    copyFile.work(f.files, f.pool);
+
+    ASSERT(isError, "copy failure should be printed as error");
+}
+
 TEST_SUIT_END
@@ -0,0 +1,204 @@
+#include "dependency/dependency.h"
+#include "mls-unit-test/unittest.h"
+#include "mocks/mockibuildrule.h"
+#include "mocks/mockibuildtarget.h"
+#include "mocks/mockifiles.h"
+#include "mocks/mockithreadpool.h"
+#include <atomic>
+#include <thread>
+
+namespace {
+
+//! A object file that is linked to a executable
+struct TestFixture {
+    TestFixture() {
+        object.output("a.o");
+        object.command("c++ -c a.cpp -o a.o");
+        executable.output("a");
+        executable.addDependency(&object);
+
+        files.mock_buildLog_0.returnValueRef(log);
+        files.mock_popenWithResult_1.returnValue(PopenResult{0, ""});
+        files.mock_invalidate_1.nice();
+        files.mock_getTimeChanged_1.returnValue(1);
+    }
+
+    MockIBuildTarget target;
+    MockIBuildRule rule;
+    MockIFiles files;
+    MockIThreadPool pool;
+    BuildLog log;
+    Dependency object{&target, true, Object, &rule};
+    Dependency executable{&target, true, Executable, &rule};
+};
+
+//! Turns on content hashes for a single test
+struct ContentHash {
+    ContentHash() {
+        globals.contentHash = true;
+    }
+
+    ~ContentHash() {
+        globals.contentHash = oldValue;
+    }
+
+    bool oldValue = globals.contentHash;
+};
+
+//! Counts added tasks, safe to use from several threads
+struct CountingThreadPool : public IThreadPool {
+    void addTask(IDependency *) override {
+        ++numberOfAddedTasks;
+    }
+
+    void print(std::string, bool) override {}
+
+    std::atomic<int> numberOfAddedTasks{0};
+};
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("dependency that is dirty before it is added") {
+    // Files is prepared in parallel, so this can happen with modules
+    TestFixture f;
+    Dependency module{&f.target, true, Object, &f.rule};
+    module.output("a.pcm");
+    module.dirty(true);
+    f.object.addDependency(&module);
+    ASSERT(f.object.dirty(), "dirtiness is not propagated to object");
+    ASSERT(f.executable.dirty(), "dirtiness is not propagated to executable");
+}
+
+TEST_CASE("identical object file does not cause relinking") {
+    ContentHash contentHash;
+    TestFixture f;
+    f.object.dirty(true);
+    ASSERT(f.executable.dirty(), "dirtiness is not propagated");
+    f.executable.prune();
+
+    // Only the new file is read, the old hash is saved from the last build
+    f.log.outputHash("a.o", 10);
+    f.files.mock_fileHash_1.returnValue(10);
+    f.files.mock_fileHash_1.expectNum(1);
+    f.pool.mock_addTask_1.expectNum(1);
+    f.object.work(f.files, f.pool);
+
+    f.files.mock_touch_1.expectNum(1);
+    ASSERT(f.executable.skipIfUnchanged(f.files, f.pool),
+           "executable should be skipped");
+    ASSERT(!f.executable.dirty(), "skipped file should be clean");
+}
+
+TEST_CASE("changed object file causes relinking") {
+    ContentHash contentHash;
+    TestFixture f;
+    f.object.dirty(true);
+    f.executable.prune();
+
+    f.log.outputHash("a.o", 10);
+    f.files.mock_fileHash_1.returnValue(11);
+    f.pool.mock_addTask_1.expectNum(1);
+    f.object.work(f.files, f.pool);
+
+    f.files.mock_touch_1.expectNum(0);
+    ASSERT(!f.executable.skipIfUnchanged(f.files, f.pool),
+           "executable should be built");
+    ASSERT_EQ(f.log.outputHash("a.o"), 11);
+}
+
+TEST_CASE("object files is not hashed without content hashes") {
+    TestFixture f;
+    f.object.dirty(true);
+    f.executable.prune();
+
+    f.files.mock_fileHash_1.expectNum(0);
+    f.pool.mock_addTask_1.expectNum(1);
+    f.object.work(f.files, f.pool);
+
+    f.files.mock_touch_1.expectNum(0);
+    ASSERT(!f.executable.skipIfUnchanged(f.files, f.pool),
+           "executable should be built");
+}
+
+TEST_CASE("outdated file is built even if dependencies is unchanged") {
+    ContentHash contentHash;
+    TestFixture f;
+    f.object.dirty(true);
+    f.executable.dirty(true); // For example if the link command is changed
+    f.executable.prune();
+
+    f.files.mock_fileHash_1.returnValue(10);
+    f.object.work(f.files, f.pool);
+
+    ASSERT(!f.executable.skipIfUnchanged(f.files, f.pool),
+           "executable should be built");
+}
+
+TEST_CASE("only dirty dependencies is waited for") {
+    TestFixture f;
+    Dependency clean{&f.target, true, Object, &f.rule};
+    clean.output("b.o");
+    f.executable.addDependency(&clean);
+    f.object.dirty(true);
+
+    f.executable.prune();
+    ASSERT_EQ(f.executable.pendingDependencies(), 1);
+}
+
+TEST_CASE("task is added once when notified from many threads") {
+    TestFixture f;
+    f.object.dirty(true);
+    std::vector<std::unique_ptr<Dependency>> objects;
+    for (int i = 0; i < 64; ++i) {
+        objects.push_back(
+            std::make_unique<Dependency>(&f.target, true, Object, &f.rule));
+        objects.back()->output("obj" + std::to_string(i) + ".o");
+        objects.back()->dirty(true);
+        f.executable.addDependency(objects.back().get());
+    }
+    f.executable.prune();
+    ASSERT_EQ(f.executable.pendingDependencies(), 65);
+
+    CountingThreadPool pool;
+    f.executable.notice(&f.object, pool, false);
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next{0};
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&] {
+            for (size_t i = next++; i < objects.size(); i = next++) {
+                f.executable.notice(objects.at(i).get(), pool, false);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(f.executable.pendingDependencies(), 0);
+    ASSERT_EQ(pool.numberOfAddedTasks, 1);
+}
+
+TEST_CASE("outputs of failed command is removed") {
+    TestFixture f;
+    f.object.input("a.cpp");
+    f.object.dirty(true);
+    f.files.mock_popenWithResult_1.returnValue(PopenResult{1, "error"});
+    f.files.mock_remove_1.expectArgs("a.o");
+    f.files.mock_remove_1.expectNum(1);
+    f.pool.mock_addTask_1.expectNum(0);
+
+    bool isThrown = false;
+    try {
+        f.object.work(f.files, f.pool);
+    }
+    catch (MatmakeError &) {
+        isThrown = true;
+    }
+    ASSERT(isThrown, "failed command should throw");
+    ASSERT(f.object.dirty(), "failed file should still be dirty");
+}
+
+TEST_SUIT_END
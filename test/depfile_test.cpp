@@ -0,0 +1,54 @@
+#include "environment/depfile.h"
+#include "mls-unit-test/unittest.h"
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("parse compiler dep file") {
+    auto res = parseDepFileContent(
+        "build/main.cpp.o: src/main.cpp include/a.h \\\n"
+        "  include/b.h\\\n"
+        " /usr/include/c.h\n");
+
+    ASSERT_EQ(res.first.size(), 4);
+    ASSERT_EQ(res.first.at(0).str(), "src/main.cpp");
+    ASSERT_EQ(res.first.at(1).str(), "include/a.h");
+    ASSERT_EQ(res.first.at(2).str(), "include/b.h");
+    ASSERT_EQ(res.first.at(3).str(), "/usr/include/c.h");
+    ASSERT_EQ(res.second, "");
+}
+
+TEST_CASE("parse dep file with command") {
+    auto res = parseDepFileContent("out: a.o b.o\n\tc++ -o out a.o b.o  \n");
+
+    ASSERT_EQ(res.first.size(), 2);
+    ASSERT_EQ(res.first.at(1).str(), "b.o");
+    ASSERT_EQ(res.second, "c++ -o out a.o b.o");
+}
+
+TEST_CASE("parse escaped characters") {
+    auto res = parseDepFileContent(
+        "a.o: src/with\\ space.cpp cost$$.h src/\\#hash.h C:\\dir\\x.h\r\n");
+
+    ASSERT_EQ(res.first.size(), 4);
+    ASSERT_EQ(res.first.at(0).str(), "src/with space.cpp");
+    ASSERT_EQ(res.first.at(1).str(), "cost$.h");
+    ASSERT_EQ(res.first.at(2).str(), "src/#hash.h");
+    ASSERT_EQ(res.first.at(3).str(), "C:\\dir\\x.h");
+}
+
+TEST_CASE("skip phony targets") {
+    auto res = parseDepFileContent("a.o: a.cpp a.h\n\na.h:\n\tcommand\n");
+
+    ASSERT_EQ(res.first.size(), 2);
+    ASSERT_EQ(res.first.at(1).str(), "a.h");
+    ASSERT_EQ(res.second, "command");
+}
+
+TEST_CASE("parse empty dep file") {
+    auto res = parseDepFileContent("");
+
+    ASSERT_EQ(res.first.size(), 0);
+    ASSERT_EQ(res.second, "");
+}
+
+TEST_SUIT_END
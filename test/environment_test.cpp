@@ -0,0 +1,106 @@
+#include "main/matmake.h"
+#include "dependency/buildfile.h"
+#include "mls-unit-test/unittest.h"
+#include "mocks/mockibuildtarget.h"
+#include "mocks/mockifiles.h"
+#include <deque>
+
+namespace {
+
+bool contains(const std::vector<PathId> &paths, const std::string &path) {
+    return std::find(paths.begin(), paths.end(), PathId{path}) != paths.end();
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("files is scanned in parallel and added to the graph") {
+    auto oldNumberOfThreads = globals.numberOfThreads;
+    globals.numberOfThreads = 4;
+
+    std::map<std::string, std::string> content = {
+        {"a.cppm", "#include \"a.h\"\nexport module a;\n"},
+        {"a.h", ""},
+        {"b.cpp", "#include \"b.h\"\nimport a;\n"},
+        {"b.h", "#include \"a.h\"\n"},
+    };
+    for (int i = 0; i < 8; ++i) {
+        content["c" + std::to_string(i) + ".cpp"] = "#include \"b.h\"\n";
+    }
+
+    auto files = std::make_shared<MockIFiles>();
+    BuildLog log;
+    BuildDatabase database;
+    ScanCache cache;
+    std::mutex mutex;
+    std::deque<std::istringstream> streams;
+    files->mock_buildLog_0.returnValueRef(log);
+    files->mock_buildDatabase_0.returnValueRef(database);
+    files->mock_scanCache_0.returnValueRef(cache);
+    files->mock_getTimeChanged_1.onCall([&content](const std::string &path) {
+        return static_cast<FileTimeT>(content.count(path));
+    });
+    files->mock_openRead_1.onCall([&](const std::string &path) {
+        std::lock_guard<std::mutex> guard(mutex);
+        streams.emplace_back(content.at(path));
+        return fileFromSs(streams.back());
+    });
+
+    MockIBuildTarget target;
+    target.mock_getBuildDirectory_0.returnValue("build/");
+    target.mock_getCompiler_1.returnValue("c++");
+    target.mock_getBuildFlags_1.returnValue("");
+    target.mock_preprocessCommand_1.onCall(
+        [](Token command) { return command; });
+    target.mock_hasModules_0.returnValue(true);
+
+    BuildRuleList rules;
+    rules.push_back(
+        std::make_unique<BuildFile>("a.cppm", &target, BuildFile::CppToPcm));
+    rules.push_back(
+        std::make_unique<BuildFile>("b.cpp", &target, BuildFile::CppToO));
+    for (int i = 0; i < 8; ++i) {
+        rules.push_back(std::make_unique<BuildFile>(
+            "c" + std::to_string(i) + ".cpp", &target, BuildFile::CppToO));
+    }
+
+    Environment environment(files);
+    environment.prescan(rules);
+
+    IDependency *a = nullptr;
+    IDependency *b = nullptr;
+    for (auto &rule : rules) {
+        auto &dependency = rule->dependency();
+        if (dependency.output() == "build/a.pcm") {
+            a = &dependency;
+        }
+        else if (dependency.output() == "build/b.cpp.o") {
+            b = &dependency;
+        }
+    }
+    ASSERT(a && b, "files should exist");
+
+    ASSERT_EQ(b->dependencies().count(a), 1);
+
+    auto aEntry = database.get("build/a.pcm.d");
+    ASSERT(contains(aEntry->dependencies, "a.cppm"), "");
+    ASSERT(contains(aEntry->dependencies, "a.h"), "");
+
+    auto bEntry = database.get("build/b.cpp.o.d");
+    ASSERT(contains(bEntry->dependencies, "b.cpp"), "");
+    ASSERT(contains(bEntry->dependencies, "b.h"), "");
+    ASSERT(contains(bEntry->dependencies, "a.h"), "");
+    ASSERT(contains(bEntry->dependencies, "build/a.pcm"), "");
+
+    for (int i = 0; i < 8; ++i) {
+        auto entry =
+            database.get("build/c" + std::to_string(i) + ".cpp.o.d");
+        ASSERT(contains(entry->dependencies, "b.h"), i);
+        ASSERT(contains(entry->dependencies, "a.h"), i);
+    }
+
+    globals.numberOfThreads = oldNumberOfThreads;
+}
+
+TEST_SUIT_END
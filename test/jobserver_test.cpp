@@ -0,0 +1,49 @@
+
+#include "environment/jobserver.h"
+#include "mls-unit-test/unittest.h"
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("parse file descriptors from MAKEFLAGS") {
+    auto auth = JobServer::parseMakeFlags(" -j4 --jobserver-auth=3,4 -- x=1");
+    ASSERT_EQ(auth.readFd, 3);
+    ASSERT_EQ(auth.writeFd, 4);
+    ASSERT_EQ(auth.fifo, "");
+}
+
+TEST_CASE("parse old style MAKEFLAGS") {
+    auto auth = JobServer::parseMakeFlags("-j --jobserver-fds=5,6");
+    ASSERT_EQ(auth.readFd, 5);
+    ASSERT_EQ(auth.writeFd, 6);
+}
+
+TEST_CASE("parse fifo from MAKEFLAGS") {
+    auto auth =
+        JobServer::parseMakeFlags("-j8 --jobserver-auth=fifo:/tmp/GMfifo1");
+    ASSERT_EQ(auth.fifo, "/tmp/GMfifo1");
+}
+
+TEST_CASE("no jobserver in MAKEFLAGS") {
+    ASSERT_EQ(JobServer::parseMakeFlags("-k -s").empty(), true);
+}
+
+TEST_CASE("created jobserver gives out tokens") {
+    unsetenv("MAKEFLAGS");
+    JobServer server;
+    server.init(3);
+    ASSERT_EQ(server.isActive(), true);
+
+    // One job is run without a token
+    ASSERT_EQ(server.tryAcquire(), true);
+    ASSERT_EQ(server.tryAcquire(), true);
+    ASSERT_EQ(server.tryAcquire(), false);
+
+    server.release();
+    ASSERT_EQ(server.tryAcquire(), true);
+
+    // The jobserver is exported to child processes
+    auto auth = JobServer::parseMakeFlags(getenv("MAKEFLAGS"));
+    ASSERT_EQ(auth.empty(), false);
+}
+
+TEST_SUIT_END
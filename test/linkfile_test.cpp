@@ -0,0 +1,163 @@
+#include "dependency/linkfile.h"
+#include "mls-unit-test/unittest.h"
+#include "mocks/mockibuildtarget.h"
+#include "mocks/mockifiles.h"
+#include "mocks/mockithreadpool.h"
+
+namespace {
+
+struct TestFixture {
+    TestFixture(BuildType buildType = Executable) {
+        target.mock_getOutputDir_0.returnValue("");
+        target.mock_getBuildDirectory_0.returnValue("build/");
+        target.mock_getCompiler_1.onCall(
+            [](const Token &filetype) -> Token {
+                return (filetype == "a") ? "ar" : "c++";
+            });
+        target.mock_preprocessCommand_1.onCall(
+            [](Token command) { return command; });
+        target.mock_getLibs_0.returnValue("");
+        target.mock_getFlags_0.returnValue("");
+        target.mock_name_0.returnValue("main");
+        target.mock_buildType_0.returnValue(buildType);
+
+        files.mock_getTimeChanged_1.returnValue(1);
+        files.mock_parseDepFile_1.returnValue(MockIFiles::parseDepFileT{});
+        files.mock_buildDatabase_0.returnValueRef(database);
+        files.mock_buildLog_0.returnValueRef(log);
+        files.mock_popenWithResult_1.returnValue(PopenResult{0, ""});
+        files.mock_replaceFile_2.onCall(
+            [this](std::string name, std::string value) {
+                responseFiles[name] = value;
+            });
+
+        for (auto name : {"a.o", "b.o"}) {
+            objects.push_back(
+                std::make_unique<Dependency>(&target, true, Object, nullptr));
+            objects.back()->output(name);
+        }
+    }
+
+    //! Create a link file that depends on the first numberOfObjects objects
+    std::unique_ptr<LinkFile> createLinkFile(size_t numberOfObjects) {
+        auto link = std::make_unique<LinkFile>("main", &target, &compiler);
+        for (size_t i = 0; i < numberOfObjects; ++i) {
+            link->dependency().addDependency(objects.at(i).get());
+        }
+        link->prepare(files, otherFiles);
+        return link;
+    }
+
+    MockIBuildTarget target;
+    MockIFiles files;
+    MockIThreadPool pool;
+    GCCCompiler compiler;
+    BuildLog log;
+    BuildDatabase database;
+    BuildRuleList otherFiles;
+    std::vector<std::unique_ptr<Dependency>> objects;
+    std::map<std::string, std::string> responseFiles;
+};
+
+//! Restores the limit when the test is finished
+struct ResponseFileLimit {
+    ResponseFileLimit(size_t limit) {
+        LinkFile::responseFileLimit = limit;
+    }
+
+    ~ResponseFileLimit() {
+        LinkFile::responseFileLimit = oldLimit;
+    }
+
+    size_t oldLimit = LinkFile::responseFileLimit;
+};
+
+bool contains(const std::string &str, const std::string &part) {
+    return str.find(part) != std::string::npos;
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("short link command does not use response file") {
+    ResponseFileLimit limit(1000);
+    TestFixture f;
+    auto link = f.createLinkFile(2);
+
+    auto command = link->dependency().command();
+    ASSERT(contains(command, "a.o") && contains(command, "b.o"), command);
+    ASSERT(!contains(command, "@"), command);
+
+    f.files.mock_replaceFile_2.expectNum(0);
+    link->work(f.files, f.pool);
+}
+
+TEST_CASE("long link command uses response file") {
+    ResponseFileLimit limit(10);
+    TestFixture f;
+    auto link = f.createLinkFile(2);
+
+    auto command = link->dependency().command();
+    ASSERT(contains(command, "c++ -o main -Wl,--start-group @main.rsp "),
+           command);
+    ASSERT(!contains(command, "a.o"), command);
+
+    f.files.mock_remove_1.expectArgs("main.rsp");
+    link->work(f.files, f.pool);
+
+    auto &content = f.responseFiles["main.rsp"];
+    ASSERT(contains(content, "a.o ") && contains(content, "b.o "), content);
+
+    // The command is saved as it would be without response file
+    auto saved = f.database.get("build/main.d")->command;
+    ASSERT(contains(saved, "a.o") && contains(saved, "b.o"), saved);
+}
+
+TEST_CASE("long archive command uses response file") {
+    ResponseFileLimit limit(10);
+    TestFixture f(Static);
+    auto link = f.createLinkFile(2);
+
+    ASSERT_EQ(link->dependency().command(), "ar -rs main @main.rsp");
+    link->work(f.files, f.pool);
+
+    auto &content = f.responseFiles["main.rsp"];
+    ASSERT(contains(content, "a.o ") && contains(content, "b.o "), content);
+}
+
+TEST_CASE("changed object list is detected with response file") {
+    ResponseFileLimit limit(10);
+    TestFixture f;
+    f.createLinkFile(2)->work(f.files, f.pool);
+
+    auto unchanged = f.createLinkFile(2);
+    ASSERT(!unchanged->dependency().dirty(), "same objects should be fresh");
+
+    auto changed = f.createLinkFile(1);
+    ASSERT_EQ(changed->dependency().command(),
+              unchanged->dependency().command());
+    ASSERT(changed->dependency().dirty(), "removed object should relink");
+}
+
+TEST_CASE("failed link command is not saved") {
+    ResponseFileLimit limit(10);
+    TestFixture f;
+    f.files.mock_popenWithResult_1.returnValue(PopenResult{1, "error"});
+    auto link = f.createLinkFile(2);
+
+    bool isThrown = false;
+    try {
+        link->work(f.files, f.pool);
+    }
+    catch (MatmakeError &) {
+        isThrown = true;
+    }
+    ASSERT(isThrown, "failed link should throw");
+    ASSERT(f.database.get("build/main.d")->command.empty(),
+           "command of failed link should not be saved");
+    ASSERT(f.createLinkFile(2)->dependency().dirty(),
+           "failed link should be built again");
+}
+
+TEST_SUIT_END
@@ -18,4 +18,6 @@ public:
     MOCK_METHOD0(IDependency &, dependency, (), override);
 
     MOCK_METHOD0(std::string, moduleName, (), const override);
+
+    MOCK_METHOD0(std::string, poolName, (), const override);
 };
@@ -11,19 +11,39 @@ public:
                  override);
     MOCK_METHOD1(void, clean, (const IFiles &files), override);
     MOCK_METHOD0(void, prune, (), override);
+    MOCK_METHOD0(size_t, pendingDependencies, (), const override);
     MOCK_METHOD1(void, dirty, (bool), override);
     MOCK_METHOD0(bool, dirty, (), const override);
-    MOCK_METHOD1(time_t, changedTime, (const IFiles &files), const override);
-    MOCK_METHOD1(time_t,
+    MOCK_METHOD0(void, dirtyByDependency, (), override);
+    MOCK_METHOD1(FileTimeT,
+                 changedTime,
+                 (const IFiles &files),
+                 const override);
+    MOCK_METHOD1(FileTimeT,
                  inputChangedTime,
                  (const IFiles &files),
                  const override);
-    MOCK_METHOD2(void, notice, (IDependency * d, IThreadPool &pool), override);
-    MOCK_METHOD0(Token, output, (), const override);
-    MOCK_METHOD1(void, output, (Token value), override);
-    MOCK_METHOD0(const std::vector<Token> &, outputs, (), const override);
+    MOCK_METHOD3(void,
+                 notice,
+                 (IDependency * d, IThreadPool &pool, bool isChanged),
+                 override);
+    MOCK_METHOD0(const std::string &, output, (), const override);
+    MOCK_METHOD1(void, output, (const std::string &value), override);
+    MOCK_METHOD0(PathId, outputId, (), const override);
+    MOCK_METHOD0(const std::vector<PathId> &, outputs, (), const override);
     MOCK_METHOD1(void, addSubscriber, (IDependency * s), override);
-    MOCK_METHOD1(void, sendSubscribersNotice, (IThreadPool & pool), override);
+    MOCK_METHOD0(const std::set<IDependency *> &,
+                 subscribers,
+                 (),
+                 const override);
+    MOCK_METHOD2(void,
+                 sendSubscribersNotice,
+                 (IThreadPool & pool, bool isChanged),
+                 override);
+    MOCK_METHOD2(bool,
+                 skipIfUnchanged,
+                 (const IFiles &files, IThreadPool &pool),
+                 override);
     MOCK_METHOD1(void, addDependency, (IDependency * file), override);
     MOCK_METHOD0(bool, includeInBinary, (), const override);
     MOCK_METHOD0(BuildType, buildType, (), const override);
@@ -34,9 +54,9 @@ public:
                  (),
                  const override);
     MOCK_METHOD0(const IBuildTarget *, target, (), const override);
-    MOCK_METHOD1(void, input, (Token in), override);
-    MOCK_METHOD0(std::vector<Token>, inputs, (), const override);
-    MOCK_METHOD0(Token, input, (), const override);
+    MOCK_METHOD1(void, input, (const std::string &in), override);
+    MOCK_METHOD0(const std::vector<PathId> &, inputs, (), const override);
+    MOCK_METHOD0(const std::string &, input, (), const override);
     MOCK_METHOD1(void, depFile, (Token file), override);
     MOCK_METHOD0(Token, depFile, (), const override);
     MOCK_METHOD0(Token, command, (), const override);
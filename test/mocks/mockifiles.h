@@ -1,6 +1,9 @@
 #pragma once
 
+#include "environment/builddatabase.h"
+#include "environment/buildlog.h"
 #include "environment/ifiles.h"
+#include "environment/prescan.h"
 #include "mls-unit-test/mock.h"
 #include <fstream>
 
@@ -18,19 +21,22 @@ public:
                  (Token pattern),
                  const override);
 
-    using popenRetT = std::pair<int, std::string>;
-    MOCK_METHOD1(popenRetT,
+    MOCK_METHOD1(PopenResult,
                  popenWithResult,
                  (std::string command),
                  const override);
 
     MOCK_METHOD1( int, system, (const std::string &command), const  override);
 
-    MOCK_METHOD1(time_t,
+    MOCK_METHOD1(FileTimeT,
                  getTimeChanged,
                  (const std::string &path),
                  const override);
 
+    MOCK_METHOD1(void, invalidate, (const std::string &path), const override);
+
+    MOCK_METHOD1(uint64_t, fileHash, (const std::string &path), const override);
+
 
     MOCK_METHOD1(std::ifstream, openRead,(const std::string &path), const override);
 
@@ -62,6 +68,8 @@ public:
 
     MOCK_METHOD1(int, remove, (std::string filename), const override);
 
+    MOCK_METHOD1(void, touch, (const std::string &path), const override);
+
     MOCK_METHOD2(void,
                  replaceFile,
                  (std::string name, std::string value),
@@ -82,6 +90,12 @@ public:
                  (std::string source),
                  const override);
 
-    using parseDepFileT = std::pair<std::vector<std::string>, std::string>;
+    using parseDepFileT = std::pair<std::vector<PathId>, std::string>;
     MOCK_METHOD1(parseDepFileT, parseDepFile, (Token depFile), const override);
+
+    MOCK_METHOD0(BuildLog &, buildLog, (), const override);
+
+    MOCK_METHOD0(BuildDatabase &, buildDatabase, (), const override);
+
+    MOCK_METHOD0(ScanCache &, scanCache, (), const override);
 };
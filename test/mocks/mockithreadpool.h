@@ -6,4 +6,5 @@
 class MockIThreadPool : public IThreadPool {
 public:
     MOCK_METHOD1(void, addTask, (IDependency *), override);
+    MOCK_METHOD2(void, print, (std::string, bool), override);
 };
@@ -0,0 +1,90 @@
+#include "environment/p1689.h"
+#include "mls-unit-test/unittest.h"
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("parse json") {
+    auto value = json::parse(
+        R"_({"a": [1, -2.5, true, null], "b": {"c": "x\"y\\zA"}})_");
+
+    ASSERT(value, "could not parse json");
+    ASSERT_EQ(value->type, Json::Object);
+    ASSERT_EQ((*value)["a"].array.size(), 4);
+    ASSERT_EQ((*value)["a"].array.at(1).value, "-2.5");
+    ASSERT_EQ((*value)["a"].array.at(2).type, Json::Bool);
+    ASSERT_EQ((*value)["a"].array.at(3).type, Json::Null);
+    ASSERT_EQ((*value)["b"]["c"].value, "x\"y\\zA");
+    ASSERT_EQ((*value)["missing"].type, Json::Null);
+
+    ASSERT(!json::parse("{\"a\": }"), "invalid json should fail");
+    ASSERT(!json::parse("[1, 2"), "invalid json should fail");
+}
+
+TEST_CASE("quote json") {
+    auto str = std::string{"say \"hi\" \\ bye"};
+    auto value = json::parse(json::quote(str));
+
+    ASSERT(value, "could not parse quoted string");
+    ASSERT_EQ(value->value, str);
+}
+
+TEST_CASE("parse p1689") {
+    const std::string s = R"_({
+  "revision": 0,
+  "rules": [
+    {
+      "primary-output": "build/mod1.pcm",
+      "provides": [
+        {
+          "is-interface": true,
+          "logical-name": "mod1",
+          "source-path": "src/mod1.cppm"
+        }
+      ],
+      "requires": [
+        {
+          "logical-name": "mod2"
+        },
+        {
+          "logical-name": "mod1:part"
+        },
+        {
+          "logical-name": "header.h",
+          "lookup-method": "include-quote"
+        }
+      ]
+    },
+    {
+      "primary-output": "build/main.o",
+      "requires": [
+        {
+          "logical-name": "mod1",
+          "lookup-method": "by-name"
+        }
+      ]
+    }
+  ],
+  "version": 1
+}
+)_";
+
+    auto res = parseP1689(s);
+
+    ASSERT_EQ(res.size(), 2);
+
+    auto &mod1 = res.at("build/mod1.pcm");
+    ASSERT_EQ(mod1.exportModules.size(), 1);
+    ASSERT_EQ(mod1.exportModules.front(), "mod1");
+    ASSERT_EQ(mod1.imports.size(), 2);
+    ASSERT_EQ(mod1.imports.at(0), "mod2");
+    ASSERT_EQ(mod1.imports.at(1), "mod1:part");
+
+    auto &main = res.at("build/main.o");
+    ASSERT_EQ(main.exportModules.size(), 0);
+    ASSERT_EQ(main.imports.size(), 1);
+    ASSERT_EQ(main.imports.front(), "mod1");
+
+    ASSERT_EQ(parseP1689("not json").size(), 0);
+}
+
+TEST_SUIT_END
@@ -0,0 +1,49 @@
+#include "main/pathid.h"
+#include "mls-unit-test/unittest.h"
+#include <thread>
+#include <vector>
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("same path gives same id") {
+    auto a = PathId{"src/main.cpp"};
+    auto b = PathId{std::string{"src/"} + "main.cpp"};
+    auto c = PathId{"src/other.cpp"};
+
+    ASSERT_EQ(a, b);
+    ASSERT_NE(a, c);
+    ASSERT_EQ(a.id(), b.id());
+    ASSERT_EQ(a.str(), "src/main.cpp");
+    ASSERT_EQ(&a.str(), &b.str());
+}
+
+TEST_CASE("empty path") {
+    auto empty = PathId{};
+
+    ASSERT(empty.empty(), "default path should be empty");
+    ASSERT_EQ(empty, PathId{""});
+    ASSERT_EQ(empty.id(), 0);
+    ASSERT_EQ(empty.str(), "");
+}
+
+TEST_CASE("intern from many threads") {
+    std::vector<std::thread> threads;
+    std::vector<PathId> results(8);
+    for (size_t i = 0; i < results.size(); ++i) {
+        threads.emplace_back([&results, i] {
+            for (int j = 0; j < 1000; ++j) {
+                PathId{"thread/" + std::to_string(j)};
+            }
+            results.at(i) = PathId{"thread/500"};
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    for (auto &result : results) {
+        ASSERT_EQ(result, results.front());
+    }
+}
+
+TEST_SUIT_END
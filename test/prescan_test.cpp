@@ -1,63 +1,49 @@
 
 #include "environment/prescan.h"
+#include "mocks/mockifiles.h"
 #include "mls-unit-test/unittest.h"
+#include <map>
 #include <sstream>
 
-TEST_SUIT_BEGIN
-
-TEST_CASE("find all includes") {
-    const std::string s = R"_(
-# 1 "src/matmake-common.h" 1
-
-# 1 "src/token.h" 1
-# 1 "<built-in>" 1
-# 1 "<built-in>" 3
-# 398 "<built-in>" 3
-# 1 "<command line>" 1
-# 1 "<built-in>" 2
-
-# 1 "/usr/include/c++/9/algorithm" 1 3
-# 58 "/usr/include/c++/9/algorithm" 3
-
-# 59 "/usr/include/c++/9/algorithm" 3
-
-# 1 "/usr/include/c++/9/utility" 1 3
-         )_";
-
-    std::istringstream ss(s);
+namespace {
 
-    auto res = prescan(ss);
-
-    ASSERT_GT(res.includes.size(), 0);
-    ASSERT_GT(res.systemHeaders.size(), 0);
+//! Files to scan, that is read from memory
+struct ScanFixture {
+    ScanFixture(std::map<std::string, std::string> content)
+        : content(std::move(content)) {
+        files.mock_scanCache_0.returnValueRef(cache);
+        files.mock_getTimeChanged_1.onCall([this](const std::string &path) {
+            return static_cast<FileTimeT>(this->content.count(path));
+        });
+        files.mock_openRead_1.onCall([this](const std::string &path) {
+            ss.clear();
+            ss.str(this->content.at(path));
+            return fileFromSs(ss);
+        });
+    }
 
-    for (auto include : res.includes) {
-        std::cout << include << "\n";
+    PrescanResult scan(const std::string &flags, const std::string &path) {
+        return SourceScanner(flags).scan(files, path);
     }
 
-    std::cout << "\nsystem headers:\n";
+    std::map<std::string, std::string> content;
+    MockIFiles files;
+    ScanCache cache;
+    std::istringstream ss;
+};
 
-    for (auto include : res.systemHeaders) {
-        std::cout << include << "\n";
-    }
-}
+} // namespace
 
-TEST_CASE("prescan module") {
-    const std::string s = R"_(
-# 1 "mod1.cppm"
-# 1 "<built-in>" 1
-# 1 "<built-in>" 3
-# 408 "<built-in>" 3
-# 1 "<command line>" 1
-# 1 "<built-in>" 2
-# 1 "mod1.cppm" 2
+TEST_SUIT_BEGIN
 
+TEST_CASE("scan module") {
+    const std::string s = R"_(
 module;
 
 export module mod1;
 
 import mod2;
-# 17 "mod1.cppm"
+
 namespace mod1 {
 
 export int getNum() {
@@ -69,7 +55,7 @@ export int getNum() {
 )_";
     std::istringstream ss(s);
 
-    auto res = prescan(ss);
+    auto res = scanDirectives(ss);
 
     ASSERT_GT(res.imports.size(), 0);
     ASSERT_EQ(res.imports.front(), "mod2");
@@ -87,4 +73,196 @@ export int getNum() {
     }
 }
 
+TEST_CASE("scan directives") {
+    const std::string s = R"_(
+#include "a.h" // comment
+  #  include <vector>
+/* #include "commented.h" */
+#include \
+    "continued.h"
+#if 0
+#include "disabled.h"
+#else
+#include "enabled.h"
+#endif
+#ifdef SOMETHING
+#include "conditional.h"
+#endif
+auto str = "#include \"string.h\"";
+
+export module mod1:part1;
+import mod2;
+import :part2;
+import <iostream>;
+)_";
+
+    std::istringstream ss(s);
+
+    auto res = scanDirectives(ss);
+
+    ASSERT_EQ(res.includes.size(), 5);
+    ASSERT_EQ(res.includes.at(0).name, "a.h");
+    ASSERT_EQ(res.includes.at(0).isAngled, false);
+    ASSERT_EQ(res.includes.at(1).name, "vector");
+    ASSERT_EQ(res.includes.at(1).isAngled, true);
+    ASSERT_EQ(res.includes.at(2).name, "continued.h");
+    ASSERT_EQ(res.includes.at(3).name, "enabled.h");
+    ASSERT_EQ(res.includes.at(4).name, "conditional.h");
+
+    ASSERT_EQ(res.exportModules.size(), 1);
+    ASSERT_EQ(res.exportModules.front(), "mod1:part1");
+
+    ASSERT_EQ(res.imports.size(), 2);
+    ASSERT_EQ(res.imports.at(0), "mod2");
+    ASSERT_EQ(res.imports.at(1), "mod1:part2");
+}
+
+TEST_CASE("digit separators does not start character literals") {
+    std::istringstream ss("int x = 1'000; /*\n"
+                          "#include \"commented.h\"\n"
+                          "*/ int y = 1'000'000;\n"
+                          "#include \"after.h\"\n"
+                          "auto c = u8'\"'; auto d = 0x1'F + 'a';\n"
+                          "#include \"last.h\"\n");
+
+    auto res = scanDirectives(ss);
+
+    ASSERT_EQ(res.includes.size(), 2);
+    ASSERT_EQ(res.includes.at(0).name, "after.h");
+    ASSERT_EQ(res.includes.at(1).name, "last.h");
+}
+
+TEST_CASE("scan module implementation units") {
+    {
+        std::istringstream ss("module mod1;\nimport :part;\n");
+        auto res = scanDirectives(ss);
+
+        ASSERT_EQ(res.exportModules.size(), 0);
+        ASSERT_EQ(res.imports.size(), 2);
+        ASSERT_EQ(res.imports.at(0), "mod1");
+        ASSERT_EQ(res.imports.at(1), "mod1:part");
+    }
+
+    {
+        // A partition implementation unit does not depend on the interface
+        std::istringstream ss("module mod1:impl;\nimport :part;\n");
+        auto res = scanDirectives(ss);
+
+        ASSERT_EQ(res.imports.size(), 1);
+        ASSERT_EQ(res.imports.at(0), "mod1:part");
+    }
+}
+
+TEST_CASE("normalize path") {
+    ASSERT_EQ(normalizePath("src/../include/./a.h"), "include/a.h");
+    ASSERT_EQ(normalizePath("../a//b.h"), "../a/b.h");
+    ASSERT_EQ(normalizePath("/usr/include/x.h"), "/usr/include/x.h");
+}
+
+TEST_CASE("scan source with include paths") {
+    std::map<std::string, std::string> content = {
+        {"scan/main.cpp", "#include \"local.h\"\n#include <lib.h>\n"
+                          "#include <vector>\nimport mod2;\n"},
+        {"scan/local.h", "#pragma once\n#include \"lib.h\"\n"},
+        {"scan/include/lib.h", "#include \"../local.h\"\n"},
+        {"/usr/include/sys.h", ""},
+    };
+
+    MockIFiles files;
+    ScanCache cache;
+    files.mock_scanCache_0.returnValueRef(cache);
+    int numberOfStats = 0;
+    files.mock_getTimeChanged_1.onCall(
+        [&content, &numberOfStats](const std::string &path) {
+            ++numberOfStats;
+            return static_cast<FileTimeT>(content.count(path));
+        });
+
+    std::istringstream ss;
+    files.mock_openRead_1.onCall([&content, &ss](const std::string &path) {
+        ss.clear();
+        ss.str(content.at(path));
+        return fileFromSs(ss);
+    });
+
+    auto scanner = SourceScanner("-Wall -Iscan/include -isystem /usr/include");
+    auto res = scanner.scan(files, "scan/main.cpp");
+
+    ASSERT_EQ(res.includes.size(), 2);
+    ASSERT_EQ(res.includes.at(0), "scan/local.h");
+    ASSERT_EQ(res.includes.at(1), "scan/include/lib.h");
+    ASSERT_EQ(res.systemHeaders.size(), 0);
+
+    ASSERT_EQ(res.imports.size(), 1);
+    ASSERT_EQ(res.imports.front(), "mod2");
+
+    // Everything is remembered the second time
+    auto stats = numberOfStats;
+    auto res2 = scanner.scan(files, "scan/main.cpp");
+    ASSERT_EQ(numberOfStats, stats);
+    ASSERT_EQ(res2.includes, res.includes);
+
+    // Other include paths gives other headers
+    auto res3 = SourceScanner("").scan(files, "scan/main.cpp");
+    ASSERT_EQ(res3.includes.size(), 1);
+    ASSERT_EQ(res3.includes.at(0), "scan/local.h");
+
+    cache.clear();
+    files.mock_openRead_1.expectNum(6);
+    scanner.scan(files, "scan/main.cpp");
+}
+
+TEST_CASE("iquote paths is only used for quoted includes") {
+    std::map<std::string, std::string> content = {
+        {"main.cpp", "#include \"quoted.h\"\n#include <angled.h>\n"},
+        {"quote/quoted.h", ""},
+        {"quote/angled.h", ""},
+    };
+
+    ScanFixture f(content);
+
+    auto res = f.scan("-iquote quote", "main.cpp");
+    ASSERT_EQ(res.includes.size(), 1);
+    ASSERT_EQ(res.includes.at(0), "quote/quoted.h");
+
+    // The same header with -I is found for both
+    auto res2 = f.scan("-Iquote", "main.cpp");
+    ASSERT_EQ(res2.includes.size(), 2);
+}
+
+TEST_CASE("headers is system headers only when found in system paths") {
+    ScanFixture f({
+        {"main.cpp", "#include <lib.h>\n#include <sys.h>\n"},
+        {"/abs/include/lib.h", "#include \"dep.h\"\n"},
+        {"/abs/include/dep.h", ""},
+        {"/abs/system/sys.h", "#include \"ignored.h\"\n"},
+        {"/abs/system/ignored.h", ""},
+    });
+
+    auto res = f.scan("-I/abs/include -isystem /abs/system", "main.cpp");
+
+    // Project headers with absolute paths is still tracked and scanned
+    ASSERT_EQ(res.includes.size(), 2);
+    ASSERT_EQ(res.includes.at(0), "/abs/include/lib.h");
+    ASSERT_EQ(res.includes.at(1), "/abs/include/dep.h");
+
+    ASSERT_EQ(res.systemHeaders.size(), 1);
+    ASSERT_EQ(res.systemHeaders.at(0), "/abs/system/sys.h");
+}
+
+TEST_CASE("msvc include paths is only read as separate words") {
+    ScanFixture f({
+        {"main.cpp", "#include <lib.h>\n"},
+        {"include/lib.h", ""},
+    });
+
+    auto res = f.scan("/W4 /I include", "main.cpp");
+    ASSERT_EQ(res.includes.size(), 1);
+    ASSERT_EQ(res.includes.at(0), "include/lib.h");
+
+    // A word that only starts with /I could be a path, like /Include/a.h
+    auto res2 = f.scan("/Iinclude", "main.cpp");
+    ASSERT_EQ(res2.includes.size(), 0);
+}
+
 TEST_SUIT_END
@@ -0,0 +1,94 @@
+
+#include "environment/process.h"
+#include "mls-unit-test/unittest.h"
+#include <chrono>
+#include <thread>
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("split simple command") {
+    std::vector<std::string> args;
+    ASSERT_EQ(splitCommand("c++ -c  -o main.o main.cpp", args), true);
+    ASSERT_EQ(args.size(), 5);
+    ASSERT_EQ(args.at(0), "c++");
+    ASSERT_EQ(args.at(4), "main.cpp");
+}
+
+TEST_CASE("split quoted arguments") {
+    std::vector<std::string> args;
+    ASSERT_EQ(
+        splitCommand("c++ -o main -Wl,-rpath='${ORIGIN}' \"-DX=a b\"", args),
+        true);
+    ASSERT_EQ(args.size(), 5);
+    ASSERT_EQ(args.at(3), "-Wl,-rpath=${ORIGIN}");
+    ASSERT_EQ(args.at(4), "-DX=a b");
+}
+
+TEST_CASE("commands that needs a shell") {
+    std::vector<std::string> args;
+    ASSERT_EQ(splitCommand("c++ -E main.cpp 2>/dev/null", args), false);
+    ASSERT_EQ(splitCommand("echo $HOME", args), false);
+    ASSERT_EQ(splitCommand("cat a | grep b", args), false);
+    ASSERT_EQ(splitCommand("ls *.cpp", args), false);
+    ASSERT_EQ(splitCommand("CXX=g++ make", args), false);
+    ASSERT_EQ(splitCommand("echo \"$HOME\"", args), false);
+    ASSERT_EQ(splitCommand("echo 'unterminated", args), false);
+    ASSERT_EQ(splitCommand("cd build\nmake", args), false);
+}
+
+TEST_CASE("run command without shell") {
+    auto res = runCommand("echo hello 'to you'");
+    ASSERT_EQ(res.first, 0);
+    ASSERT_EQ(res.second, "hello to you\n");
+}
+
+TEST_CASE("run command in shell") {
+    auto res = runCommand("echo out; echo err >&2; exit 3");
+    ASSERT_EQ(res.first, 3);
+    ASSERT_EQ(res.second, "out\n");
+    ASSERT_EQ(res.errorOutput, "err\n");
+}
+
+TEST_CASE("large output on both streams") {
+    // More than fits in a pipe, on both stdout and stderr
+    auto res = runCommand(
+        "head -c 300000 /dev/zero; head -c 300000 /dev/zero >&2; echo");
+    ASSERT_EQ(res.first, 0);
+    ASSERT_EQ(res.second.size(), 300001);
+    ASSERT_EQ(res.errorOutput.size(), 300000);
+}
+
+TEST_CASE("missing command") {
+    auto res = runCommand("matmake-command-that-does-not-exist");
+    ASSERT_EQ(res.first, 127);
+}
+
+TEST_CASE("running commands is killed") {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    PopenResult res;
+    std::thread thread([&res] { res = runCommand("sleep 10"); });
+
+    std::this_thread::sleep_for(milliseconds(100));
+    // Commands that is started after the bailout is killed when they start
+    globals.bailout = true;
+    killRunningProcesses();
+    thread.join();
+    globals.bailout = false;
+
+    ASSERT_EQ(res.first, -1);
+    ASSERT(steady_clock::now() - start < seconds(5),
+           "the command should be stopped at once");
+}
+
+TEST_CASE("too many running commands to track") {
+    RunningProcesses processes;
+    for (int i = 0; i < 1024; ++i) {
+        ASSERT(processes.add(100000 + i), "there should be free slots");
+    }
+    ASSERT(!processes.add(200000), "a full list should be reported");
+    processes.remove(100000);
+    ASSERT(processes.add(200000), "removed slots should be reused");
+}
+
+TEST_SUIT_END
@@ -0,0 +1,55 @@
+
+#include "environment/statcache.h"
+#include "mls-unit-test/unittest.h"
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("each file is checked once") {
+    StatCache cache;
+    int numberOfChecks = 0;
+    auto getTime = [&numberOfChecks](const std::string &) -> FileTimeT {
+        ++numberOfChecks;
+        return 10;
+    };
+
+    ASSERT_EQ(cache.get("a.h", getTime), 10);
+    ASSERT_EQ(cache.get("a.h", getTime), 10);
+    ASSERT_EQ(numberOfChecks, 1);
+
+    cache.get("b.h", getTime);
+    ASSERT_EQ(numberOfChecks, 2);
+}
+
+TEST_CASE("invalidated files is checked again") {
+    StatCache cache;
+    FileTimeT time = 10;
+    auto getTime = [&time](const std::string &) { return time; };
+
+    cache.get("a.o", getTime);
+    time = 20;
+    ASSERT_EQ(cache.get("a.o", getTime), 10);
+
+    cache.invalidate("a.o");
+    ASSERT_EQ(cache.get("a.o", getTime), 20);
+
+    time = 30;
+    cache.clear();
+    ASSERT_EQ(cache.get("a.o", getTime), 30);
+}
+
+TEST_CASE("file changed while checked is not cached") {
+    StatCache cache;
+    FileTimeT time = 10;
+
+    cache.get("a.o", [&](const std::string &path) {
+        // Another thread writes the file at the same time
+        cache.invalidate(path);
+        return time;
+    });
+
+    time = 20;
+    ASSERT_EQ(cache.get("a.o", [&](const std::string &) { return time; }),
+              20);
+}
+
+TEST_SUIT_END
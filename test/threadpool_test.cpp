@@ -1,31 +1,317 @@
-
 #include "environment/threadpool.h"
 #include "mls-unit-test/unittest.h"
 #include "mocks/mockibuildrule.h"
 #include "mocks/mockidependency.h"
 #include "mocks/mockifiles.h"
 
-TEST_SUIT_BEGIN
+namespace {
 
-TEST_CASE("work is dispatched to build rule") {
-    ThreadPool pool;
+//! Restores the globals that a test changes, also when an assert fails
+struct GlobalsGuard {
+    ~GlobalsGuard() {
+        globals.numberOfThreads = numberOfThreads;
+        globals.maxFailures = maxFailures;
+        globals.bailout = bailout;
+    }
+
+    size_t numberOfThreads = globals.numberOfThreads;
+    size_t maxFailures = globals.maxFailures;
+    bool bailout = globals.bailout;
+};
+
+//! A dirty file and the rule that builds it
+struct Task {
     MockIDependency dependency;
-    auto rule = std::make_unique<MockIBuildRule>();
+    MockIBuildRule *rule = nullptr; // Owned by the file list
+    std::set<IDependency *> subscribers;
+};
+
+struct TestFixture {
+    TestFixture() {
+        fileHandler.mock_buildLog_0.returnValueRef(log);
+    }
+
+    //! Create a task that the pool expects to build. The task is not ready
+    //! until it is added to the pool
+    //! @param duration the time in ms it took to build the last time
+    Task &createTask(const std::string &output, long duration = 0) {
+        auto &task = createDependency(output, duration);
+        auto rule = std::make_unique<MockIBuildRule>();
+        task.rule = rule.get();
+        task.dependency.mock_parentRule_0.returnValue(rule.get());
+        rule->mock_dependency_0.returnValueRef(task.dependency);
+        fileList.push_back(std::move(rule));
+        pool.addTaskCount();
+        return task;
+    }
+
+    //! Create a file that is never built but makes the critical path of
+    //! the task longer
+    void addSubscriber(Task &task, const std::string &output, long duration) {
+        task.subscribers.insert(&createDependency(output, duration).dependency);
+    }
+
+    void work() {
+        pool.work(std::move(fileList), fileHandler);
+    }
+
+    // Destroyed last, so that the pool is stopped before globals is restored
+    GlobalsGuard guard;
+    std::vector<std::unique_ptr<Task>> tasks;
     MockIFiles fileHandler;
+    BuildLog log;
     BuildRuleList fileList;
+    ThreadPool pool;
+
+private:
+    Task &createDependency(const std::string &output, long duration) {
+        tasks.push_back(std::make_unique<Task>());
+        auto &task = *tasks.back();
+        task.dependency.mock_output_0.returnValueRef(PathId{output}.str());
+        task.dependency.mock_dirty_0.returnValue(true);
+        task.dependency.mock_subscribers_0.returnValueRef(task.subscribers);
+        if (duration) {
+            log.duration(output, duration);
+        }
+        return task;
+    }
+};
+
+//! Saves the order that tasks is built in, from any thread
+struct BuildOrder {
+    void onWork(Task &task, const std::string &name) {
+        task.rule->mock_work_2.onCall([this, name](auto &&, auto &&) {
+            std::lock_guard<std::mutex> guard(mutex);
+            order.push_back(name);
+            return std::string{};
+        });
+    }
+
+    bool hasStarted() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return !order.empty();
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+};
+
+template <typename ConditionT>
+void waitFor(ConditionT condition) {
+    for (int i = 0; i < 1000 && !condition(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("work is dispatched to build rule") {
+    TestFixture f;
+    auto &task = f.createTask("a.o");
+
+    task.dependency.mock_parentRule_0.expectMinNum(1);
+    task.rule->mock_work_2.expectNum(1);
+
+    f.pool.addTask(&task.dependency);
+    f.work();
+}
+
+TEST_CASE("tasks added from a worker is dispatched") {
+    TestFixture f;
+    globals.numberOfThreads = 4;
+    auto &task1 = f.createTask("1.o");
+    auto &task2 = f.createTask("2.o");
+
+    // The first rule makes the second rule ready when it is finished
+    task1.rule->mock_work_2.onCall([&task2](auto &&, IThreadPool &pool) {
+        pool.addTask(&task2.dependency);
+        return std::string{};
+    });
+    task1.rule->mock_work_2.expectNum(1);
+    task2.rule->mock_work_2.expectNum(1);
+
+    f.pool.addTask(&task1.dependency);
+    f.work();
+}
+
+TEST_CASE("tasks on the critical path is started first") {
+    TestFixture f;
+    BuildOrder order;
+    globals.numberOfThreads = 1;
+    auto &task1 = f.createTask("1.o", 10);
+    auto &task2 = f.createTask("2.o", 10);
+    f.addSubscriber(task2, "main", 1000);
+
+    order.onWork(task1, "1.o");
+    order.onWork(task2, "2.o");
 
-    dependency.mock_parentRule_0.expectMinNum(1);
-    dependency.mock_parentRule_0.returnValue(rule.get());
-    dependency.mock_dirty_0.nice();
+    f.pool.addTask(&task1.dependency);
+    f.pool.addTask(&task2.dependency);
+    f.work();
 
-    rule->mock_dependency_0.returnValueRef(dependency);
-    rule->mock_work_2.expectNum(1);
+    ASSERT_EQ(order.order.size(), 2);
+    ASSERT_EQ(order.order.front(), "2.o");
+}
+
+TEST_CASE("tasks added from a worker is ordered by critical path") {
+    TestFixture f;
+    BuildOrder order;
+    // A single worker thread, that uses its own queue
+    globals.numberOfThreads = 2;
+    auto &first = f.createTask("0.o", 10);
+    auto &task1 = f.createTask("1.o", 10);
+    auto &task2 = f.createTask("2.o", 10);
+    f.addSubscriber(task2, "main", 1000);
+
+    first.rule->mock_work_2.onCall(
+        [&task1, &task2](auto &&, IThreadPool &pool) {
+            pool.addTask(&task2.dependency);
+            pool.addTask(&task1.dependency);
+            return std::string{};
+        });
+    order.onWork(task1, "1.o");
+    order.onWork(task2, "2.o");
+
+    f.pool.addTask(&first.dependency);
+    f.work();
+
+    ASSERT_EQ(order.order.size(), 2);
+    ASSERT_EQ(order.order.front(), "2.o");
+}
+
+TEST_CASE("tasks waits for a full job pool") {
+    TestFixture f;
+    std::atomic<int> running{0};
+    std::atomic<int> maxRunning{0};
+    std::atomic<int> finished{0};
+
+    globals.numberOfThreads = 4;
+    f.pool.poolSize("link", 1);
+
+    for (int i = 0; i < 3; ++i) {
+        auto &task = f.createTask(std::to_string(i) + ".o");
+        task.rule->mock_poolName_0.returnValue(std::string{"link"});
+        task.rule->mock_work_2.onCall([&](auto &&, auto &&) {
+            maxRunning = std::max<int>(maxRunning, ++running);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            --running;
+            ++finished;
+            return std::string{};
+        });
+        f.pool.addTask(&task.dependency);
+    }
+
+    f.work();
+
+    ASSERT_EQ(finished, 3);
+    ASSERT_EQ(maxRunning, 1);
+}
+
+TEST_CASE("the most critical task is stolen from a busy worker") {
+    TestFixture f;
+    BuildOrder order;
+    std::atomic<bool> isAdded{false};
+
+    globals.numberOfThreads = 2;
+    auto &first = f.createTask("0.o", 10);
+    auto &blocker = f.createTask("b.o", 10);
+    auto &task1 = f.createTask("1.o", 10);
+    auto &task2 = f.createTask("2.o", 10);
+    f.addSubscriber(task2, "main", 1000);
+
+    // Both tasks is queued on the worker running the first task, and that
+    // worker stays busy until the other worker has stolen one of them
+    first.rule->mock_work_2.onCall([&](auto &&, IThreadPool &pool) {
+        pool.addTask(&task1.dependency);
+        pool.addTask(&task2.dependency);
+        isAdded = true;
+        waitFor([&order] { return order.hasStarted(); });
+        return std::string{};
+    });
+    blocker.rule->mock_work_2.onCall([&](auto &&, auto &&) {
+        waitFor([&] { return isAdded.load(); });
+        return std::string{};
+    });
+    order.onWork(task1, "1.o");
+    order.onWork(task2, "2.o");
+
+    f.pool.addTask(&first.dependency);
+    f.pool.addTask(&blocker.dependency);
+    f.work();
+
+    ASSERT_EQ(order.order.size(), 2);
+    ASSERT_EQ(order.order.front(), "2.o");
+}
+
+TEST_CASE("independent tasks is built after a failure in keep going mode") {
+    TestFixture f;
+    globals.numberOfThreads = 1;
+    globals.maxFailures = 0;
+    auto &failing = f.createTask("1.o");
+    auto &independent = f.createTask("2.o");
+
+    failing.rule->mock_work_2.onCall([](auto &&, auto &&) -> std::string {
+        throw MatmakeError(Token("1.cpp"), "could not build object");
+    });
+    independent.rule->mock_work_2.expectNum(1);
+
+    f.pool.addTask(&failing.dependency);
+    f.pool.addTask(&independent.dependency);
+    f.work();
+
+    // The build is still reported as failed
+    ASSERT_EQ(globals.bailout, true);
+}
+
+TEST_CASE("for each element in parallel") {
+    GlobalsGuard guard;
+    globals.numberOfThreads = 4;
+
+    ThreadPool pool;
+    std::vector<int> numbers(1000, 1);
+    std::atomic<int> sum{0};
+    pool.forEach(numbers, [&sum](int &number) {
+        sum += number;
+        number = 2;
+    });
+
+    ASSERT_EQ(sum, 1000);
+    ASSERT_EQ(std::count(numbers.begin(), numbers.end(), 2), 1000);
+
+    bool isThrown = false;
+    try {
+        pool.forEach(numbers, [](int) {
+            throw MatmakeError(Token("1.cpp"), "could not prepare file");
+        });
+    }
+    catch (MatmakeError &) {
+        isThrown = true;
+    }
+    ASSERT(isThrown, "exception from a thread should be thrown again");
+}
+
+TEST_CASE("for each runs on the same workers every time") {
+    GlobalsGuard guard;
+    globals.numberOfThreads = 4;
+
+    ThreadPool pool;
+    std::vector<int> numbers(100, 1);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    auto rememberThread = [&](int) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        std::lock_guard<std::mutex> guard(mutex);
+        threads.insert(std::this_thread::get_id());
+    };
 
-    pool.addTask(&dependency);
-    pool.addTaskCount();
+    pool.forEach(numbers, rememberThread);
+    pool.forEach(numbers, rememberThread);
 
-    fileList.push_back(move(rule));
-    pool.work(std::move(fileList), fileHandler);
+    ASSERT(threads.size() > 1, "work should be done in parallel");
+    ASSERT(threads.size() <= 4, "workers should be reused");
+    ASSERT_EQ(threads.count(std::this_thread::get_id()), 0);
 }
 
 TEST_SUIT_END